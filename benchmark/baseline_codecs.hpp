@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+#include <sdsl/bits.hpp>
+#include <sdsl/dac_vector.hpp>
+#include <sdsl/int_vector.hpp>
+
+/* Dependency-free baselines with random access and scans, to compare NeaTS with the usual block codecs on a clean
+ * machine (the squash, Chimp, Gorilla and TSXor baselines of neats_lossless.cpp need external sources). All of them
+ * compress a vector of int64_t and offer operator[], scan(from, to, out), decompress(out) and size_in_bits(), whose
+ * count includes every per-block header.
+ *
+ *   for_codec    frame of reference: blocks of block_size values, each stored as value - min of the block with the
+ *                bit width of the largest difference
+ *   delta_codec  the first value of each block, then the zigzag-encoded differences bit-packed with the width of the
+ *                largest one; operator[] adds up the differences from the start of the block
+ *   dac_codec    sdsl::dac_vector_dp on the values minus their minimum (directly addressable codes) */
+namespace baselines {
+
+    namespace detail {
+        inline uint64_t zigzag(int64_t v) {
+            return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+        }
+
+        inline int64_t unzigzag(uint64_t v) {
+            return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+        }
+
+        inline void write_bits(sdsl::int_vector<64> &bits, uint64_t offset, uint64_t v, uint8_t width) {
+            if (width != 0)
+                sdsl::bits::write_int(bits.data() + (offset >> 6u), v, offset & 0x3F, width);
+        }
+
+        inline uint64_t read_bits(const sdsl::int_vector<64> &bits, uint64_t offset, uint8_t width) {
+            return width == 0 ? 0 : sdsl::bits::read_int(bits.data() + (offset >> 6u), offset & 0x3F, width);
+        }
+    }
+
+    /** Blocks of values stored with a per-block base and bit width: the common part of for_codec and delta_codec. */
+    class block_codec {
+    protected:
+        size_t block_size;
+        size_t n = 0;
+        std::vector<int64_t> bases;       // per block
+        std::vector<uint8_t> widths;      // per block
+        std::vector<uint64_t> offsets;    // per block, bit offset in packed
+        sdsl::int_vector<64> packed;
+
+        explicit block_codec(size_t _block_size) : block_size{std::max<size_t>(1, _block_size)} {}
+
+        /* Packs the codes of every block, given a function that computes the base and the codes of a block. */
+        template<typename Encode>
+        void pack(const std::vector<int64_t> &data, Encode &&encode) {
+            n = data.size();
+            const auto num_blocks = (n + block_size - 1) / block_size;
+            bases.resize(num_blocks);
+            widths.resize(num_blocks);
+            offsets.resize(num_blocks);
+
+            std::vector<uint64_t> codes(n);
+            uint64_t total = 0;
+            for (size_t b = 0; b < num_blocks; ++b) {
+                const auto from = b * block_size;
+                const auto len = std::min(block_size, n - from);
+                bases[b] = encode(data.data() + from, len, codes.data() + from);
+                widths[b] = static_cast<uint8_t>(std::bit_width(*std::max_element(codes.begin() + from,
+                                                                                  codes.begin() + from + len)));
+                offsets[b] = total;
+                total += widths[b] * len;
+            }
+
+            packed = sdsl::int_vector<64>((total + 63) / 64 + 1, 0);
+            for (size_t b = 0; b < num_blocks; ++b) {
+                const auto from = b * block_size;
+                const auto len = std::min(block_size, n - from);
+                for (size_t j = 0; j < len; ++j)
+                    detail::write_bits(packed, offsets[b] + j * widths[b], codes[from + j], widths[b]);
+            }
+        }
+
+    public:
+
+        [[nodiscard]] size_t size() const {
+            return n;
+        }
+
+        [[nodiscard]] size_t size_in_bits() const {
+            return packed.bit_size() + bases.size() * (sizeof(int64_t) + sizeof(uint8_t) + sizeof(uint64_t)) * 8;
+        }
+    };
+
+    class for_codec : public block_codec {
+    public:
+
+        explicit for_codec(size_t _block_size = 128) : block_codec{_block_size} {}
+
+        void compress(const std::vector<int64_t> &data) {
+            pack(data, [](const int64_t *values, size_t len, uint64_t *codes) {
+                const auto base = *std::min_element(values, values + len);
+                for (size_t j = 0; j < len; ++j)
+                    codes[j] = static_cast<uint64_t>(values[j]) - static_cast<uint64_t>(base);
+                return base;
+            });
+        }
+
+        [[nodiscard]] int64_t operator[](size_t i) const {
+            const auto b = i / block_size;
+            const auto w = widths[b];
+            return bases[b] + static_cast<int64_t>(detail::read_bits(packed, offsets[b] + (i % block_size) * w, w));
+        }
+
+        void scan(size_t from, size_t to, int64_t *out) const {
+            while (from < to) {
+                const auto b = from / block_size;
+                const auto e = std::min(to, (b + 1) * block_size);
+                const auto w = widths[b];
+                auto offset = offsets[b] + (from % block_size) * w;
+                for (; from < e; ++from, offset += w)
+                    *out++ = bases[b] + static_cast<int64_t>(detail::read_bits(packed, offset, w));
+            }
+        }
+
+        void decompress(int64_t *out) const {
+            scan(0, n, out);
+        }
+    };
+
+    class delta_codec : public block_codec {
+    public:
+
+        explicit delta_codec(size_t _block_size = 128) : block_codec{_block_size} {}
+
+        void compress(const std::vector<int64_t> &data) {
+            pack(data, [](const int64_t *values, size_t len, uint64_t *codes) {
+                codes[0] = 0;
+                for (size_t j = 1; j < len; ++j)
+                    codes[j] = detail::zigzag(static_cast<int64_t>(static_cast<uint64_t>(values[j]) -
+                                                                   static_cast<uint64_t>(values[j - 1])));
+                return values[0];
+            });
+        }
+
+        [[nodiscard]] int64_t operator[](size_t i) const {
+            const auto b = i / block_size;
+            const auto w = widths[b];
+            auto v = static_cast<uint64_t>(bases[b]);
+            auto offset = offsets[b] + w;
+            for (size_t j = 1; j <= i % block_size; ++j, offset += w)
+                v += static_cast<uint64_t>(detail::unzigzag(detail::read_bits(packed, offset, w)));
+            return static_cast<int64_t>(v);
+        }
+
+        void scan(size_t from, size_t to, int64_t *out) const {
+            while (from < to) {
+                const auto b = from / block_size;
+                const auto e = std::min(to, (b + 1) * block_size);
+                const auto w = widths[b];
+                auto v = static_cast<uint64_t>(bases[b]);
+                auto offset = offsets[b] + w;
+                for (auto j = b * block_size + 1; j < e; ++j, offset += w) {
+                    if (j - 1 >= from)
+                        *out++ = static_cast<int64_t>(v);
+                    v += static_cast<uint64_t>(detail::unzigzag(detail::read_bits(packed, offset, w)));
+                }
+                *out++ = static_cast<int64_t>(v);
+                from = e;
+            }
+        }
+
+        void decompress(int64_t *out) const {
+            scan(0, n, out);
+        }
+    };
+
+    class dac_codec {
+        int64_t base = 0;
+        sdsl::dac_vector_dp<> values;
+
+    public:
+
+        void compress(const std::vector<int64_t> &data) {
+            base = data.empty() ? 0 : *std::min_element(data.begin(), data.end());
+            std::vector<uint64_t> shifted(data.size());
+            std::transform(data.begin(), data.end(), shifted.begin(), [&](int64_t v) {
+                return static_cast<uint64_t>(v) - static_cast<uint64_t>(base);
+            });
+            values = sdsl::dac_vector_dp<>(shifted);
+        }
+
+        [[nodiscard]] size_t size() const {
+            return values.size();
+        }
+
+        [[nodiscard]] size_t size_in_bits() const {
+            return sdsl::size_in_bytes(values) * 8 + sizeof(base) * 8;
+        }
+
+        [[nodiscard]] int64_t operator[](size_t i) const {
+            return base + static_cast<int64_t>(values[i]);
+        }
+
+        void scan(size_t from, size_t to, int64_t *out) const {
+            for (auto it = values.begin() + from; from < to; ++from, ++it)
+                *out++ = base + static_cast<int64_t>(*it);
+        }
+
+        void decompress(int64_t *out) const {
+            scan(0, values.size(), out);
+        }
+    };
+}
@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <latch>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "../include/NeaTS.hpp"
+#include "../include/segment_store.hpp"
+#include "synthetic_series.hpp"
+
+/* Reader scaling on one shared compressor: 1, 2, 4, ... up to max_threads threads (all the hardware threads by
+ * default) issue random accesses (operator[]) or range scans (simd_scan) concurrently on the same instance, without any
+ * locking, as allowed by the thread-safety contract of the compressor (every const member function may run
+ * concurrently). The store_scan workload runs the same scans on a segment_store holding the data in blocks of
+ * store_block values, whose reads take a shared lock and may span two blocks. Each row reports the aggregate
+ * throughput and the scaling efficiency, i.e. the throughput divided by threads times the single-thread throughput.
+ *
+ *   concurrency_bench [dataset=synth:mixed:n=8388608] [bpc=12] [queries=1000000] [scan_len=1000] [max_threads=#hw]
+ *                     [pin=1]
+ *
+ * The dataset is a .bin file (size followed by the int64_t values) or a synth:<spec> series (see synthetic_series.hpp).
+ * Every thread runs all the queries, starting from a different one, so that each thread must produce the same checksum:
+ * a mismatch means that a concurrent read returned a wrong value, and makes the benchmark exit with 2. With pin=1 the
+ * thread t is pinned to the core t mod #hw (Linux only). */
+
+using compressor_t = pfa::neats::compressor<uint32_t, int64_t, double, float, double>;
+
+constexpr size_t store_block = 1 << 16; // the default compaction threshold, so that the blocks are never merged
+
+template<typename T>
+void do_not_optimize(T const &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+std::vector<int64_t> load_dataset(const std::string &name) {
+    if (name.rfind("synth:", 0) == 0)
+        return synthetic::generate(name.substr(6));
+    std::ifstream in(name, std::ios::binary);
+    size_t size = 0;
+    in.read(reinterpret_cast<char *>(&size), sizeof(size_t));
+    std::vector<int64_t> data(size);
+    in.read(reinterpret_cast<char *>(data.data()), static_cast<std::streamsize>(size * sizeof(int64_t)));
+    if (!in || data.empty())
+        throw std::runtime_error("cannot read " + name);
+    return data;
+}
+
+void pin_to_core(size_t core) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void) core;
+#endif
+}
+
+/* Runs f(t) on num_threads threads released together, returns the wall-clock time in ns. */
+template<typename F>
+uint64_t run_threads(size_t num_threads, bool pin, F &&f) {
+    const auto hw = std::max(1u, std::thread::hardware_concurrency());
+    std::latch ready(num_threads + 1);
+    std::vector<std::jthread> pool;
+    for (size_t t = 0; t < num_threads; ++t) {
+        pool.emplace_back([&, t] {
+            if (pin)
+                pin_to_core(t % hw);
+            ready.arrive_and_wait();
+            f(t);
+        });
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    ready.arrive_and_wait();
+    pool.clear(); // joins
+    auto t2 = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+}
+
+int main(int argc, char *argv[]) {
+    const std::string dataset = argc > 1 ? argv[1] : "synth:mixed:n=8388608";
+    const uint8_t bpc = argc > 2 ? std::stoi(argv[2]) : 12;
+    const size_t num_queries = argc > 3 ? std::stoull(argv[3]) : 1000000;
+    const size_t scan_len = argc > 4 ? std::stoull(argv[4]) : 1000;
+    const size_t max_threads = argc > 5 ? std::stoull(argv[5]) : std::max(1u, std::thread::hardware_concurrency());
+    const bool pin = argc > 6 ? std::stoi(argv[6]) != 0 : true;
+
+    std::vector<int64_t> data;
+    try {
+        data = load_dataset(dataset);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    const auto n = data.size();
+    if (n <= scan_len) {
+        std::cerr << "the dataset must have more than scan_len values" << std::endl;
+        return 1;
+    }
+    auto min_data = *std::min_element(data.begin(), data.end());
+    min_data = min_data < 0 ? (min_data - 1) : -1;
+    for (auto &d: data)
+        d -= min_data - static_cast<int64_t>(BPC_TO_EPSILON(bpc));
+
+    compressor_t c(bpc);
+    c.partitioning(data.begin(), data.end());
+
+    pfa::neats::segment_store<compressor_t> store(bpc);
+    for (size_t b = 0; b < n; b += store_block) {
+        const auto e = std::min(n, b + store_block);
+        std::vector<int64_t> timestamps(e - b);
+        for (size_t i = b; i < e; ++i)
+            timestamps[i - b] = static_cast<int64_t>(i);
+        store.append(timestamps, {data.begin() + b, data.begin() + e});
+    }
+
+    std::mt19937 gen(2323);
+    std::uniform_int_distribution<uint32_t> dist(0, n - 1);
+    std::uniform_int_distribution<uint32_t> scan_dist(0, n - scan_len);
+    std::vector<uint32_t> positions(num_queries), scan_positions(num_queries);
+    for (size_t i = 0; i < num_queries; ++i) {
+        positions[i] = dist(gen);
+        scan_positions[i] = scan_dist(gen);
+    }
+
+    // the checksums every thread must obtain, whatever its first query
+    std::vector<uint64_t> prefix(n + 1, 0);
+    for (size_t i = 0; i < n; ++i)
+        prefix[i + 1] = prefix[i] + static_cast<uint64_t>(data[i]);
+    uint64_t ra_expected = 0, scan_expected = 0;
+    for (size_t i = 0; i < num_queries; ++i) {
+        ra_expected += static_cast<uint64_t>(data[positions[i]]);
+        scan_expected += prefix[scan_positions[i] + scan_len] - prefix[scan_positions[i]];
+    }
+
+    std::vector<size_t> thread_counts;
+    for (size_t t = 1; t < max_threads; t *= 2)
+        thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+
+    std::cout << "workload,dataset,n,bpc,threads,pinned,operations,total_ns,ns_per_op,mops_per_s,mvalues_per_s,"
+              << "speedup,efficiency,verified" << std::endl;
+    bool ok = true;
+    for (const std::string workload: {"ra", "scan", "store_scan"}) {
+        const bool scan = workload != "ra";
+        const bool on_store = workload == "store_scan";
+        const size_t values_per_op = scan ? scan_len : 1;
+        double single_thread_mops = 0;
+        for (auto th: thread_counts) {
+            std::vector<uint64_t> checksums(th, 0);
+            const auto ns = run_threads(th, pin, [&](size_t t) {
+                const auto first = (t * 7919) % num_queries;
+                uint64_t sum = 0;
+                if (scan) {
+                    std::vector<int64_t> out(scan_len);
+                    for (size_t i = 0; i < num_queries; ++i) {
+                        const auto s = scan_positions[(first + i) % num_queries];
+                        if (on_store) {
+                            store.scan(s, s + scan_len, out.data());
+                        } else {
+                            std::fill(out.begin(), out.end(), 0);
+                            c.simd_scan(s, s + scan_len, out.data());
+                        }
+                        for (auto v: out)
+                            sum += static_cast<uint64_t>(v);
+                    }
+                } else {
+                    for (size_t i = 0; i < num_queries; ++i)
+                        sum += static_cast<uint64_t>(c[positions[(first + i) % num_queries]]);
+                }
+                do_not_optimize(sum);
+                checksums[t] = sum;
+            });
+
+            const auto expected = scan ? scan_expected : ra_expected;
+            const bool verified = std::all_of(checksums.begin(), checksums.end(),
+                                              [&](auto s) { return s == expected; });
+            ok &= verified;
+
+            const auto ops = th * num_queries;
+            const auto mops = static_cast<double>(ops) * 1e3 / static_cast<double>(ns);
+            if (th == 1)
+                single_thread_mops = mops;
+            const auto speedup = single_thread_mops > 0 ? mops / single_thread_mops : 0.0;
+            std::cout << workload << "," << dataset << "," << n << "," << +bpc << "," << th << "," << pin << ","
+                      << ops << "," << ns << "," << static_cast<double>(ns) * th / ops << "," << mops << ","
+                      << mops * values_per_op << "," << speedup << "," << speedup / th << "," << verified
+                      << std::endl;
+        }
+    }
+    if (!ok)
+        std::cerr << "concurrent reads returned wrong values" << std::endl;
+    return ok ? 0 : 2;
+}
@@ -0,0 +1,107 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../include/NeaTS.hpp"
+#include "perf_counters.hpp"
+
+/* Compares random access and full decompression with and without huge pages (see include/huge_pages.hpp) on a
+ * synthetic series. The compressor is loaded from the same serialized bytes in both modes, so that only the page size
+ * backing its structures changes. dTLB misses are read with perf_counters and reported as -1 when the counter is not
+ * available (e.g. perf_event_paranoid > 2 or inside some containers). */
+
+using compressor_t = pfa::neats::compressor<uint32_t, int64_t, double, float, double>;
+
+/* AnonHugePages of the process, in kB. */
+size_t anon_huge_pages_kb() {
+    std::ifstream in("/proc/self/smaps_rollup");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.rfind("AnonHugePages:", 0) == 0)
+            return std::stoull(line.substr(std::strlen("AnonHugePages:")));
+    }
+    return 0;
+}
+
+std::vector<int64_t> make_series(size_t n, uint64_t seed) {
+    std::mt19937_64 gen(seed);
+    std::normal_distribution<double> step(0, 4);
+    std::uniform_int_distribution<int64_t> noise(-500, 500);
+    std::vector<int64_t> data(n);
+    double level = 0;
+    for (auto &d: data) {
+        level += step(gen);
+        d = static_cast<int64_t>(level) + noise(gen);
+    }
+    return data;
+}
+
+int main(int argc, char *argv[]) {
+    size_t n = argc > 1 ? std::stoull(argv[1]) : (size_t{1} << 23);
+    uint8_t bpc = argc > 2 ? std::stoi(argv[2]) : 12;
+    size_t num_queries = argc > 3 ? std::stoull(argv[3]) : 2000000;
+
+    auto data = make_series(n, 42);
+    auto min_data = *std::min_element(data.begin(), data.end());
+    min_data = min_data < 0 ? (min_data - 1) : -1;
+    for (auto &d: data)
+        d -= min_data - static_cast<int64_t>(BPC_TO_EPSILON(bpc));
+
+    std::stringstream serialized;
+    {
+        compressor_t c(bpc);
+        c.partitioning(data.begin(), data.end());
+        c.serialize(serialized);
+    }
+
+    std::mt19937 gen(2323);
+    std::uniform_int_distribution<size_t> dist(0, n - 1);
+    std::vector<size_t> queries(num_queries);
+    for (auto &q: queries)
+        q = dist(gen);
+
+    perf_counters counter;
+    std::cout << "huge_pages,n,bpc,anon_huge_pages(kB),random_access(ns),random_access_dtlb_misses/query,"
+              << "decompression(ns/value),decompression_dtlb_misses/value" << std::endl;
+    for (bool on: {false, true}) {
+        pfa::neats::huge_pages::set_enabled(on);
+        serialized.clear();
+        serialized.seekg(0);
+        auto c = compressor_t::load(serialized);
+        pfa::neats::huge_pages::vector<int64_t> out(n);
+
+        int64_t sum = 0;
+        counter.start();
+        auto t1 = std::chrono::steady_clock::now();
+        for (auto q: queries)
+            sum += c[q];
+        auto t2 = std::chrono::steady_clock::now();
+        auto ra_misses = counter.stop()[perf_counters::dtlb_misses];
+        auto ra_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+
+        counter.start();
+        t1 = std::chrono::steady_clock::now();
+        c.simd_decompress(out.data());
+        t2 = std::chrono::steady_clock::now();
+        auto dec_misses = counter.stop()[perf_counters::dtlb_misses];
+        auto dec_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+
+        if (!std::equal(out.begin(), out.end(), data.begin())) {
+            std::cerr << "decompressed data does not match the input" << std::endl;
+            return 1;
+        }
+
+        auto per = [](int64_t v, size_t d) { return v < 0 ? -1.0 : static_cast<double>(v) / d; };
+        std::cout << on << "," << n << "," << +bpc << "," << anon_huge_pages_kb() << ","
+                  << static_cast<double>(ra_ns) / num_queries << "," << per(ra_misses, num_queries) << ","
+                  << static_cast<double>(dec_ns) / n << "," << per(dec_misses, n) << std::endl;
+        if (sum == 42)
+            std::cerr << std::endl; // keeps the accesses alive
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+/* Log-linear histogram in the style of HdrHistogram: values below 2^sub_bits are counted exactly, larger ones are
+ * grouped by their highest set bit and then split in 2^sub_bits linear sub-buckets. Every value is thus kept with a
+ * relative error below 2^-sub_bits (1.6%) in a fixed ~30KB table, and histograms of different threads can be merged. */
+class latency_histogram {
+    static constexpr unsigned sub_bits = 6;
+    static constexpr uint64_t sub_count = uint64_t{1} << sub_bits;
+
+    std::array<uint64_t, (65 - sub_bits) * sub_count> counts{};
+    uint64_t total = 0;
+    uint64_t min_value = std::numeric_limits<uint64_t>::max();
+    uint64_t max_value = 0;
+    long double sum = 0;
+
+    static size_t index_of(uint64_t v) {
+        if (v < sub_count)
+            return v;
+        const unsigned e = std::bit_width(v) - 1;
+        const auto mantissa = (v >> (e - sub_bits)) & (sub_count - 1);
+        return sub_count + (e - sub_bits) * sub_count + mantissa;
+    }
+
+    /* The largest value that falls in the bucket idx. */
+    static uint64_t highest_equivalent(size_t idx) {
+        if (idx < sub_count)
+            return idx;
+        const auto k = idx - sub_count;
+        const auto shift = k / sub_count;
+        const auto mantissa = k % sub_count;
+        return ((sub_count + mantissa + 1) << shift) - 1;
+    }
+
+public:
+
+    void record(uint64_t v) {
+        ++counts[index_of(v)];
+        ++total;
+        min_value = std::min(min_value, v);
+        max_value = std::max(max_value, v);
+        sum += v;
+    }
+
+    void merge(const latency_histogram &other) {
+        for (size_t i = 0; i < counts.size(); ++i)
+            counts[i] += other.counts[i];
+        total += other.total;
+        min_value = std::min(min_value, other.min_value);
+        max_value = std::max(max_value, other.max_value);
+        sum += other.sum;
+    }
+
+    [[nodiscard]] uint64_t count() const {
+        return total;
+    }
+
+    [[nodiscard]] uint64_t max() const {
+        return max_value;
+    }
+
+    [[nodiscard]] uint64_t min() const {
+        return total ? min_value : 0;
+    }
+
+    [[nodiscard]] double mean() const {
+        return total ? static_cast<double>(sum / total) : 0.0;
+    }
+
+    /** Returns the value below or at which a fraction q (in [0, 1]) of the recorded values lie. */
+    [[nodiscard]] uint64_t percentile(double q) const {
+        if (total == 0)
+            return 0;
+        const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(total))));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= rank)
+                return std::min(highest_equivalent(i), max_value);
+        }
+        return max_value;
+    }
+};
@@ -0,0 +1,922 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <latch>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/NeaTS.hpp"
+#include "../include/NeaTSL.hpp"
+#include "baseline_codecs.hpp"
+#include "latency_histogram.hpp"
+#include "perf_counters.hpp"
+#include "regression_gate.hpp"
+#include "resident_memory.hpp"
+#include "synthetic_series.hpp"
+
+/* A single, configurable benchmark driver: every combination of compressor, dataset, bpc, workload and thread count
+ * produces one row with a fixed schema, as CSV or JSON lines.
+ *
+ *   neats_bench [--config=file]
+ *               [--compressors=neats,neats_quantized,neats_patched,neats_lossy,neats_relative:0.01,for,delta,dac]
+ *               [--datasets=a.bin,dir]
+ *               [--bpcs=8,12,16] [--workloads=ra,batch:64,scan:1000,decompress] [--threads=1,4]
+ *               [--distributions=uniform,zipf:0.99,sequential,clustered:4096] [--queries=1000000] [--warmup=10000]
+ *               [--latency=1] [--first_is_size=1] [--format=csv|json] [--seed=2323] [--profile=file] [--memory=file]
+ *               [--repeat=1] [--baseline=file] [--tolerance=0.05] [--bits_tolerance=0.001]
+ *
+ * The baselines of baseline_codecs.hpp (`for[:block]` frame of reference, `delta[:block]` delta + zigzag + bit-packing,
+ * `dac` directly addressable codes) do not depend on the bpc: they run once per dataset, with bpc 0 in their rows. So
+ * does `neats_relative[:delta]`, the lossy compressor with only the relative bound delta (0.01 by default), which runs
+ * on the values as they are (shifted only when some are not positive) and is checked against its per-point bound.
+ *
+ * The config file holds the same keys, one `key = value` per line (# starts a comment); the command line overrides it.
+ * Datasets are binary files of int64_t (optionally preceded by their size), directories of .bin files, or synthetic
+ * series generated in memory, written `synth:<spec>` (e.g. `synth:mixed:n=1000000:seed=1`, see synthetic_series.hpp).
+ * Workloads:
+ * `ra[:count]` random accesses, `batch:k[:count]` batches of k accesses (sorted, served by one iterator),
+ * `scan:len[:count]` range scans of len values, `decompress[:runs]` full decompressions (split in equal ranges among
+ * the threads, the output of the last run is checked against the data). The distributions pick the accessed positions
+ * (the first position of scans and batches); decompress ignores them.
+ *
+ * Every operation is timed on its own (the timer overhead, a few tens of ns, is included) into a latency histogram, and
+ * each row reports its p50, p90, p99, p99.9 and max. The first `warmup` operations of every thread are not measured.
+ * With --latency=0 the operations are not timed individually, which keeps the timer out of the hardware counters.
+ *
+ * The hardware counters of perf_counters.hpp (cycles, instructions, L1D/LLC/dTLB misses, branch misses) are read around
+ * each measured workload and reported per decoded value, or -1 when they are not available. A `compress` row reports
+ * the time and the counters of partitioning, per input value.
+ *
+ * Every row also carries the memory of its compression: the resident memory it added to the process (the peak RSS
+ * minus the RSS before it, see resident_memory.hpp) and, with a build with ENABLE_MEMORY_ACCOUNTING, the peak heap
+ * usage and the number of allocations of partitioning (see memory_accounting.hpp); -1 when not available (the
+ * baselines are not instrumented). compression_peak_bytes_per_value is the larger of the two peaks per input value.
+ *
+ * With --profile=file, and a build with ENABLE_PROFILING, the breakdown of each partitioning (see profiling.hpp) is
+ * written to file, one `compressor,dataset,n,bpc,phase,calls,ns,self_ns` row per phase or counter. Likewise, with
+ * --memory=file and ENABLE_MEMORY_ACCOUNTING, the allocations of partitioning, make_residuals and of a load of the
+ * serialized compressor are written one `compressor,dataset,n,bpc,phase,calls,allocations,deallocations,
+ * allocated_bytes,peak_bytes,retained_bytes` row per phase.
+ *
+ * --repeat=N runs every compressor N times on each dataset and bpc (the `run` field numbers them). With
+ * --baseline=file, the rows are also compared with the JSON rows of an earlier run stored in file (see
+ * regression_gate.hpp): compression and decompression MB/s, random access p99 and bits per value that are worse by
+ * more than the tolerance, with a 95% confidence, are reported on stderr as regressions, and the exit code is 3.
+ * Timings with a single run on either side are reported as insufficient_runs and never fail the gate. */
+
+using x_t = uint32_t;
+using y_t = int64_t;
+
+template<typename T>
+void do_not_optimize(T const &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct options {
+    std::vector<std::string> compressors{"neats"};
+    std::vector<std::string> datasets{};
+    std::vector<int64_t> bpcs{12};
+    std::vector<std::string> workloads{"ra", "scan:1000", "decompress"};
+    std::vector<int64_t> threads{1};
+    std::vector<std::string> distributions{"uniform"};
+    size_t queries = 1000000;
+    size_t warmup = 10000;
+    bool latency = true;
+    bool first_is_size = true;
+    std::string format = "csv";
+    uint64_t seed = 2323;
+    std::string profile{};
+    std::string memory{};
+    size_t repeat = 1;
+    std::string baseline{};
+    regression::tolerances tolerances{};
+};
+
+std::string trim(const std::string &s) {
+    auto b = s.find_first_not_of(" \t\r");
+    auto e = s.find_last_not_of(" \t\r");
+    return b == std::string::npos ? std::string{} : s.substr(b, e - b + 1);
+}
+
+std::vector<std::string> split(const std::string &s, char sep = ',') {
+    std::vector<std::string> res;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, sep)) {
+        item = trim(item);
+        if (!item.empty())
+            res.push_back(item);
+    }
+    return res;
+}
+
+std::vector<int64_t> split_ints(const std::string &s) {
+    std::vector<int64_t> res;
+    for (const auto &v: split(s))
+        res.push_back(std::stoll(v));
+    return res;
+}
+
+void set_option(options &opts, const std::string &key, const std::string &value) {
+    if (key == "compressors") opts.compressors = split(value);
+    else if (key == "datasets") opts.datasets = split(value);
+    else if (key == "bpcs") opts.bpcs = split_ints(value);
+    else if (key == "workloads") opts.workloads = split(value);
+    else if (key == "threads") opts.threads = split_ints(value);
+    else if (key == "distributions") opts.distributions = split(value);
+    else if (key == "queries") opts.queries = std::stoull(value);
+    else if (key == "warmup") opts.warmup = std::stoull(value);
+    else if (key == "latency") opts.latency = std::stoi(value) != 0;
+    else if (key == "first_is_size") opts.first_is_size = std::stoi(value) != 0;
+    else if (key == "format") opts.format = value;
+    else if (key == "seed") opts.seed = std::stoull(value);
+    else if (key == "profile") opts.profile = value;
+    else if (key == "memory") opts.memory = value;
+    else if (key == "repeat") opts.repeat = std::max<size_t>(1, std::stoull(value));
+    else if (key == "baseline") opts.baseline = value;
+    else if (key == "tolerance") opts.tolerances.timing = std::stod(value);
+    else if (key == "bits_tolerance") opts.tolerances.bits = std::stod(value);
+    else throw std::runtime_error("unknown option " + key);
+}
+
+void read_config(options &opts, const std::string &fn) {
+    std::ifstream in(fn);
+    if (!in)
+        throw std::runtime_error("cannot open " + fn);
+    std::string line;
+    while (std::getline(in, line)) {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+        auto eq = line.find('=');
+        if (eq == std::string::npos)
+            throw std::runtime_error("malformed line in " + fn + ": " + line);
+        set_option(opts, trim(line.substr(0, eq)), trim(line.substr(eq + 1)));
+    }
+}
+
+options parse_options(int argc, char *argv[]) {
+    options opts;
+    std::vector<std::pair<std::string, std::string>> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a.rfind("--", 0) != 0)
+            throw std::runtime_error("unexpected argument " + a);
+        a = a.substr(2);
+        auto eq = a.find('=');
+        if (eq != std::string::npos)
+            args.emplace_back(a.substr(0, eq), a.substr(eq + 1));
+        else if (i + 1 < argc)
+            args.emplace_back(a, argv[++i]);
+        else
+            throw std::runtime_error("missing value for --" + a);
+    }
+    // the config file first, so that the command line overrides it
+    for (const auto &[k, v]: args) {
+        if (k == "config")
+            read_config(opts, v);
+    }
+    for (const auto &[k, v]: args) {
+        if (k != "config")
+            set_option(opts, k, v);
+    }
+    if (opts.format != "csv" && opts.format != "json")
+        throw std::runtime_error("format must be csv or json");
+    if (!opts.profile.empty() && !pfa::neats::profiling::enabled)
+        throw std::runtime_error("--profile needs a build with ENABLE_PROFILING");
+    if (!opts.memory.empty() && !pfa::neats::memory::enabled)
+        throw std::runtime_error("--memory needs a build with ENABLE_MEMORY_ACCOUNTING");
+    return opts;
+}
+
+std::vector<std::filesystem::path> expand_datasets(const std::vector<std::string> &datasets) {
+    std::vector<std::filesystem::path> files;
+    for (const auto &d: datasets) {
+        if (std::filesystem::is_directory(d)) {
+            std::vector<std::filesystem::path> dir;
+            for (const auto &entry: std::filesystem::directory_iterator(d)) {
+                if (entry.is_regular_file() && entry.path().extension() == ".bin")
+                    dir.push_back(entry.path());
+            }
+            std::sort(dir.begin(), dir.end());
+            files.insert(files.end(), dir.begin(), dir.end());
+        } else {
+            // synth:<spec> is kept as is and generated by load_dataset
+            files.emplace_back(d);
+        }
+    }
+    return files;
+}
+
+std::vector<y_t> read_dataset(const std::filesystem::path &fn, bool first_is_size) {
+    std::ifstream in(fn, std::ios::binary | std::ios::ate);
+    if (!in)
+        throw std::runtime_error("cannot open " + fn.string());
+    auto bytes = static_cast<size_t>(in.tellg());
+    in.seekg(0);
+    size_t size = bytes / sizeof(y_t);
+    if (first_is_size) {
+        if (bytes < sizeof(size_t))
+            throw std::runtime_error("missing size header in " + fn.string());
+        in.read(reinterpret_cast<char *>(&size), sizeof(size_t));
+        size = std::min(size, (bytes - sizeof(size_t)) / sizeof(y_t));
+    }
+    std::vector<y_t> data(size);
+    in.read(reinterpret_cast<char *>(data.data()), size * sizeof(y_t));
+    if (!in || data.empty())
+        throw std::runtime_error("cannot read " + fn.string());
+    return data;
+}
+
+std::vector<y_t> load_dataset(const std::filesystem::path &fn, bool first_is_size) {
+    const auto name = fn.string();
+    if (name.rfind("synth:", 0) == 0)
+        return synthetic::generate(name.substr(6));
+    return read_dataset(fn, first_is_size);
+}
+
+/* One output row. Every row has all the fields, so CSV and JSON carry the same schema. */
+struct row {
+    std::string compressor;
+    std::string dataset;
+    size_t n = 0;
+    int64_t bpc = 0;
+    size_t threads = 1;
+    size_t run = 0; // of --repeat
+    std::string workload;
+    std::string distribution;
+    size_t operations = 0;
+    size_t values = 0; // values decoded by the workload
+    size_t compressed_bits = 0;
+    uint64_t compression_ns = 0;
+    int64_t compression_peak_rss_bytes = -1;  // resident memory added by the compression
+    int64_t compression_peak_heap_bytes = -1; // peak of the accounted heap usage of partitioning
+    int64_t compression_allocations = -1;
+    uint64_t total_ns = 0; // wall-clock time of the workload
+    latency_histogram latency; // of a single operation, in ns
+    perf_counters::values_t counters = [] {
+        perf_counters::values_t v;
+        v.fill(-1);
+        return v;
+    }(); // of the whole workload, -1 if not available
+
+    static void header(std::ostream &os, const std::string &format) {
+        if (format != "csv")
+            return;
+        os << "compressor,dataset,n,bpc,threads,workload,distribution,operations,compressed_bits,bits_per_value,"
+           << "compression_ratio,compression_ns,compression_peak_rss_bytes,compression_peak_heap_bytes,"
+           << "compression_allocations,compression_peak_bytes_per_value,total_ns,ns_per_op,mvalues_per_s,"
+           << "p50_ns,p90_ns,p99_ns,p999_ns,max_ns";
+        for (auto name: perf_counters::names)
+            os << "," << name << "_per_value";
+        os << ",run" << std::endl;
+    }
+
+    [[nodiscard]] double peak_bytes_per_value() const {
+        const auto peak = std::max(compression_peak_rss_bytes, compression_peak_heap_bytes);
+        return peak < 0 || n == 0 ? -1.0 : static_cast<double>(peak) / n;
+    }
+
+    [[nodiscard]] double per_value(size_t e) const {
+        return counters[e] < 0 || values == 0 ? -1.0 : static_cast<double>(counters[e]) / values;
+    }
+
+    void print(std::ostream &os, const std::string &format) const {
+        const auto bits_per_value = static_cast<double>(compressed_bits) / n;
+        const auto ratio = static_cast<double>(n * sizeof(y_t) * 8) / compressed_bits;
+        // average latency of one operation, as seen by one thread
+        const auto ns_per_op = operations ? static_cast<double>(total_ns) * threads / operations : 0.0;
+        const auto mvalues_per_s = total_ns > 0 ? values * 1e3 / static_cast<double>(total_ns) : 0.0;
+        if (format == "csv") {
+            os << compressor << "," << dataset << "," << n << "," << bpc << "," << threads << "," << workload << ","
+               << distribution << "," << operations << "," << compressed_bits << "," << bits_per_value << ","
+               << ratio << "," << compression_ns << "," << compression_peak_rss_bytes << ","
+               << compression_peak_heap_bytes << "," << compression_allocations << "," << peak_bytes_per_value() << ","
+               << total_ns << "," << ns_per_op << "," << mvalues_per_s << ","
+               << latency.percentile(0.5) << "," << latency.percentile(0.9) << "," << latency.percentile(0.99) << ","
+               << latency.percentile(0.999) << "," << latency.max();
+            for (size_t e = 0; e < perf_counters::num_events; ++e)
+                os << "," << per_value(e);
+            os << "," << run << std::endl;
+        } else {
+            os << "{\"compressor\":\"" << compressor << "\",\"dataset\":\"" << dataset << "\",\"n\":" << n
+               << ",\"bpc\":" << bpc << ",\"threads\":" << threads << ",\"workload\":\"" << workload
+               << "\",\"distribution\":\"" << distribution << "\",\"operations\":" << operations << ",\"compressed_bits\":" << compressed_bits
+               << ",\"bits_per_value\":" << bits_per_value << ",\"compression_ratio\":" << ratio
+               << ",\"compression_ns\":" << compression_ns
+               << ",\"compression_peak_rss_bytes\":" << compression_peak_rss_bytes
+               << ",\"compression_peak_heap_bytes\":" << compression_peak_heap_bytes
+               << ",\"compression_allocations\":" << compression_allocations
+               << ",\"compression_peak_bytes_per_value\":" << peak_bytes_per_value() << ",\"total_ns\":" << total_ns
+               << ",\"ns_per_op\":" << ns_per_op << ",\"mvalues_per_s\":" << mvalues_per_s
+               << ",\"p50_ns\":" << latency.percentile(0.5) << ",\"p90_ns\":" << latency.percentile(0.9)
+               << ",\"p99_ns\":" << latency.percentile(0.99) << ",\"p999_ns\":" << latency.percentile(0.999)
+               << ",\"max_ns\":" << latency.max();
+            for (size_t e = 0; e < perf_counters::num_events; ++e)
+                os << ",\"" << perf_counters::names[e] << "_per_value\":" << per_value(e);
+            os << ",\"run\":" << run << "}" << std::endl;
+        }
+    }
+};
+
+/* Uniform access to the compressors under test. */
+struct neats_adapter {
+    using compressor_t = pfa::neats::compressor<x_t, y_t, double, float, double>;
+    std::unique_ptr<compressor_t> c;
+    bool patched;
+
+    neats_adapter(int64_t bpc, bool quantized, bool _patched)
+            : c{std::make_unique<compressor_t>(static_cast<uint8_t>(bpc), false, quantized, _patched)},
+              patched{_patched} {}
+
+    void compress(const std::vector<y_t> &data) { c->partitioning(data.begin(), data.end()); }
+
+    [[nodiscard]] size_t size_in_bits() const { return c->size_in_bits(); }
+
+    [[nodiscard]] y_t at(size_t i) const { return (*c)[i]; }
+
+    /* positions must be sorted: the iterator keeps the fragment of the previous access */
+    void batch(const size_t *positions, size_t k, y_t *out) const {
+        auto it = c->iterator_at(positions[0]);
+        for (size_t j = 0; j < k; ++j) {
+            it += static_cast<std::ptrdiff_t>(positions[j]) - static_cast<std::ptrdiff_t>(it.position());
+            out[j] = *it;
+        }
+    }
+
+    void scan(size_t from, size_t to, y_t *out) const {
+        std::fill(out, out + (to - from), 0);
+        c->simd_scan(from, to, out);
+    }
+
+    void decompress(y_t *out) const { c->simd_decompress(out); }
+
+    /* out must be zeroed: simd_scan adds the decoded values to it */
+    void decompress_range(size_t from, size_t to, y_t *out) const { c->simd_scan(from, to, out); }
+
+    /* approx_at and approx_scan, which never read the residuals, must stay within their bounds of the data, and be
+     * exact at the exceptions of the patched layout */
+    [[nodiscard]] bool approx_matches(const std::vector<y_t> &data) const {
+        std::vector<y_t> approx(data.size()), bounds(data.size());
+        c->approx_scan(0, data.size(), approx.data(), bounds.data());
+        const auto step = std::max<size_t>(1, data.size() / 100000);
+        for (size_t i = 0; i < data.size(); ++i) {
+            if (std::abs(data[i] - approx[i]) > bounds[i])
+                return false;
+            if (patched && c->exception_at(i) != 0 && (approx[i] != data[i] || bounds[i] != 0))
+                return false;
+            if (i % step == 0) {
+                const auto [y, e] = c->approx_at(i);
+                if (std::abs(data[i] - y) > e || e != bounds[i] || (e == 0 && y != data[i]))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    /* the allocations of a load of the serialized compressor */
+    [[nodiscard]] pfa::neats::memory::allocation_profile load_profile() const {
+        std::stringstream ss;
+        c->serialize(ss);
+        auto l = compressor_t::load(ss);
+        return l.memory_profile();
+    }
+
+    [[nodiscard]] bool matches(const std::vector<y_t> &data, const std::vector<y_t> &out) const {
+        return data == out;
+    }
+};
+
+/* With delta > 0 only the relative bound is set (epsilon is 0) and bpc is ignored. */
+struct neats_lossy_adapter {
+    using compressor_t = neats::lossy_compressor<x_t, y_t>;
+    int64_t epsilon;
+    double delta;
+    std::unique_ptr<compressor_t> c;
+
+    explicit neats_lossy_adapter(int64_t bpc, double _delta = 0)
+            : epsilon{_delta > 0 ? 0 : static_cast<int64_t>(BPC_TO_EPSILON(bpc))}, delta{_delta},
+              c{std::make_unique<compressor_t>(epsilon, true, delta)} {}
+
+    void compress(const std::vector<y_t> &data) { c->partitioning(data.begin(), data.end()); }
+
+    [[nodiscard]] size_t size_in_bits() const { return c->size_in_bits(); }
+
+    [[nodiscard]] y_t at(size_t i) const { return (*c)[i]; }
+
+    void batch(const size_t *positions, size_t k, y_t *out) const {
+        for (size_t j = 0; j < k; ++j)
+            out[j] = (*c)[positions[j]];
+    }
+
+    void scan(size_t from, size_t to, y_t *out) const { c->scan(from, to, out); }
+
+    void decompress(y_t *out) const { c->simd_decompress(out); }
+
+    void decompress_range(size_t from, size_t to, y_t *out) const { c->scan(from, to, out); }
+
+    /* the bound of lossy_compressor: -(tol + 1) <= y - y' <= tol, with tol = epsilon + delta * |y| */
+    [[nodiscard]] bool matches(const std::vector<y_t> &data, const std::vector<y_t> &out) const {
+        for (size_t i = 0; i < data.size(); ++i) {
+            const auto tol = pfa::piecewise_optimal_approximation<x_t, y_t>::tolerance(data[i], epsilon, delta);
+            const auto err = static_cast<double>(data[i] - out[i]);
+            if (err > tol || err < -(tol + 1))
+                return false;
+        }
+        return true;
+    }
+};
+
+/* A codec of baseline_codecs.hpp. */
+template<typename Codec>
+struct baseline_adapter {
+    std::unique_ptr<Codec> c;
+
+    explicit baseline_adapter(std::unique_ptr<Codec> _c) : c{std::move(_c)} {}
+
+    void compress(const std::vector<y_t> &data) { c->compress(data); }
+
+    [[nodiscard]] size_t size_in_bits() const { return c->size_in_bits(); }
+
+    [[nodiscard]] y_t at(size_t i) const { return (*c)[i]; }
+
+    void batch(const size_t *positions, size_t k, y_t *out) const {
+        for (size_t j = 0; j < k; ++j)
+            out[j] = (*c)[positions[j]];
+    }
+
+    void scan(size_t from, size_t to, y_t *out) const { c->scan(from, to, out); }
+
+    void decompress(y_t *out) const { c->decompress(out); }
+
+    void decompress_range(size_t from, size_t to, y_t *out) const { c->scan(from, to, out); }
+
+    [[nodiscard]] bool matches(const std::vector<y_t> &data, const std::vector<y_t> &out) const {
+        return data == out;
+    }
+};
+
+bool is_baseline(const std::string &name) {
+    const auto kind = name.substr(0, name.find(':'));
+    return kind == "for" || kind == "delta" || kind == "dac";
+}
+
+bool is_relative(const std::string &name) {
+    return name.substr(0, name.find(':')) == "neats_relative";
+}
+
+double zipf_theta(const std::vector<std::string> &parts) {
+    const double theta = parts.size() > 1 ? std::stod(parts[1]) : 0.99;
+    if (theta <= 0 || theta >= 1)
+        throw std::runtime_error("the zipf exponent must be in (0, 1)");
+    return theta;
+}
+
+/* The normalization of the zipf distribution d over range ranks, sum of 1/i^s for i in [1, range], or 0 if d is not
+ * zipf. It takes range calls to std::pow, so it is computed once per (range, s) for the whole run (the positions are
+ * drawn by the main thread only). */
+double zipf_zeta(const std::string &d, size_t range) {
+    static std::map<std::pair<size_t, double>, double> computed;
+    const auto parts = split(d, ':');
+    if (parts.at(0) != "zipf")
+        return 0;
+    const auto theta = zipf_theta(parts);
+    auto [it, inserted] = computed.try_emplace({range, theta}, 0.0);
+    if (inserted) {
+        for (size_t i = 1; i <= range; ++i)
+            it->second += 1 / std::pow(static_cast<double>(i), theta);
+    }
+    return it->second;
+}
+
+/* Draws count positions in [0, range) following the distribution d: uniform, zipf[:s] (rank r with probability
+ * proportional to 1/r^s, ranks scattered over the range by a hash), sequential (consecutive positions from a random
+ * start) or clustered[:width] (bursts of 64 positions within width of a random center). zetan is zipf_zeta(d, range). */
+std::vector<size_t> make_positions(const std::string &d, size_t range, size_t count, uint64_t seed, double zetan) {
+    auto parts = split(d, ':');
+    const auto &kind = parts.at(0);
+    std::mt19937_64 gen(seed);
+    std::uniform_int_distribution<size_t> uniform(0, range - 1);
+    std::vector<size_t> res(count);
+
+    if (kind == "uniform") {
+        for (auto &p: res)
+            p = uniform(gen);
+    } else if (kind == "zipf") {
+        // Gray et al., "Quickly generating billion-record synthetic databases", as in YCSB
+        const double theta = zipf_theta(parts);
+        const double zeta2 = 1 + 1 / std::pow(2.0, theta);
+        const double alpha = 1 / (1 - theta);
+        const double eta = (1 - std::pow(2.0 / range, 1 - theta)) / (1 - zeta2 / zetan);
+        std::uniform_real_distribution<double> u01(0, 1);
+        for (auto &p: res) {
+            const auto u = u01(gen);
+            const auto uz = u * zetan;
+            size_t rank = uz < 1 ? 0 : uz < zeta2 ? 1 : static_cast<size_t>(range * std::pow(eta * u - eta + 1, alpha));
+            rank = std::min(rank, range - 1);
+            p = (rank * 0x9E3779B97F4A7C15ull) % range; // the hot ranks are not all at the beginning of the series
+        }
+    } else if (kind == "sequential") {
+        auto p = uniform(gen);
+        for (auto &q: res) {
+            q = p;
+            p = p + 1 < range ? p + 1 : 0;
+        }
+    } else if (kind == "clustered") {
+        const size_t width = std::min<size_t>(parts.size() > 1 ? std::stoull(parts[1]) : 4096, range);
+        std::uniform_int_distribution<size_t> offset(0, width - 1);
+        size_t base = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (i % 64 == 0)
+                base = std::uniform_int_distribution<size_t>(0, range - width)(gen);
+            res[i] = base + offset(gen);
+        }
+    } else {
+        throw std::runtime_error("unknown distribution " + d);
+    }
+    return res;
+}
+
+/* Runs f(t) on num_threads threads started together, returns the wall-clock time in ns. */
+template<typename F>
+uint64_t run_threads(size_t num_threads, F &&f) {
+    std::latch ready(num_threads + 1);
+    std::vector<std::jthread> pool;
+    for (size_t t = 0; t < num_threads; ++t) {
+        pool.emplace_back([&, t] {
+            ready.arrive_and_wait();
+            f(t);
+        });
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    ready.arrive_and_wait();
+    pool.clear(); // joins
+    auto t2 = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+}
+
+/* Runs the workload w with num_threads threads on a, fills operations, values, total_ns and latency of r. Returns
+ * false if the output of the last full decompression does not match data. */
+template<typename Adapter>
+bool run_workload(const Adapter &a, const std::vector<y_t> &data, const std::string &w, size_t num_threads,
+                  const options &opts, row &r) {
+    const auto n = data.size();
+    auto parts = split(w, ':');
+    const auto &kind = parts.at(0);
+    auto arg = [&](size_t k, size_t def) { return parts.size() > k ? std::stoull(parts[k]) : def; };
+    auto elapsed = [](auto t1, auto t2) -> uint64_t {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+    };
+    std::vector<latency_histogram> histograms(num_threads);
+
+    // positions[t] holds warmup + count positions of the thread t drawn from the distribution, in [0, range)
+    auto draw = [&](size_t count, size_t range) {
+        std::vector<std::vector<size_t>> positions(num_threads);
+        const auto zetan = zipf_zeta(r.distribution, range);
+        for (size_t t = 0; t < num_threads; ++t)
+            positions[t] = make_positions(r.distribution, range, opts.warmup + count, opts.seed + t, zetan);
+        return positions;
+    };
+
+    // each thread runs warmup + count operations that decode len values each, op(t, i, out) is the operation i of
+    // the thread t
+    auto run_ops = [&](size_t count, size_t len, auto &&op) {
+        run_threads(num_threads, [&](size_t t) {
+            pfa::neats::huge_pages::vector<y_t> out(len);
+            for (size_t i = 0; i < opts.warmup; ++i)
+                op(t, i, out.data());
+            do_not_optimize(out.data());
+        });
+
+        perf_counters counters;
+        counters.start();
+        r.total_ns = run_threads(num_threads, [&](size_t t) {
+            pfa::neats::huge_pages::vector<y_t> out(len);
+            if (opts.latency) {
+                for (size_t i = opts.warmup; i < opts.warmup + count; ++i) {
+                    auto t1 = std::chrono::steady_clock::now();
+                    op(t, i, out.data());
+                    auto t2 = std::chrono::steady_clock::now();
+                    histograms[t].record(elapsed(t1, t2));
+                }
+            } else {
+                for (size_t i = opts.warmup; i < opts.warmup + count; ++i)
+                    op(t, i, out.data());
+            }
+            do_not_optimize(out.data());
+        });
+        r.counters = counters.stop();
+        r.operations = count * num_threads;
+        r.values = r.operations * len;
+    };
+
+    if (kind == "ra") {
+        const auto count = arg(1, opts.queries);
+        auto positions = draw(count, n);
+        run_ops(count, 1, [&](size_t t, size_t i, y_t *out) {
+            out[0] = a.at(positions[t][i]);
+            do_not_optimize(out[0]);
+        });
+    } else if (kind == "batch") {
+        // the operation i fetches the k sorted positions [i * k, (i + 1) * k)
+        const auto k = std::max<size_t>(1, arg(1, 64));
+        const auto count = arg(2, std::max<size_t>(1, opts.queries / k));
+        std::vector<std::vector<size_t>> positions(num_threads);
+        const auto zetan = zipf_zeta(r.distribution, n);
+        for (size_t t = 0; t < num_threads; ++t) {
+            auto &ps = positions[t];
+            ps = make_positions(r.distribution, n, (opts.warmup + count) * k, opts.seed + t, zetan);
+            for (size_t i = 0; i < opts.warmup + count; ++i)
+                std::sort(ps.begin() + i * k, ps.begin() + (i + 1) * k);
+        }
+        run_ops(count, k, [&](size_t t, size_t i, y_t *out) {
+            a.batch(positions[t].data() + i * k, k, out);
+        });
+    } else if (kind == "scan") {
+        const auto len = std::min<size_t>(arg(1, 1000), n);
+        const auto count = arg(2, 10000);
+        auto positions = draw(count, n - len + 1);
+        run_ops(count, len, [&](size_t t, size_t i, y_t *out) {
+            a.scan(positions[t][i], positions[t][i] + len, out);
+        });
+    } else if (kind == "decompress") {
+        // every run, with any number of threads, decodes the same equal ranges with decompress_range into a buffer
+        // cleared before the timer (and the counters) start
+        const auto runs = std::max<size_t>(1, arg(1, 3));
+        pfa::neats::huge_pages::vector<y_t> out(n);
+        uint64_t total = 0;
+        perf_counters counters;
+        r.counters.fill(0);
+        for (size_t k = 0; k < runs; ++k) {
+            std::fill(out.begin(), out.end(), 0);
+            counters.start();
+            const auto ns = run_threads(num_threads, [&](size_t t) {
+                const auto s = n * t / num_threads, e = n * (t + 1) / num_threads;
+                a.decompress_range(s, e, out.data() + s);
+            });
+            const auto run_counters = counters.stop();
+            for (size_t e = 0; e < run_counters.size(); ++e)
+                r.counters[e] = run_counters[e] < 0 || r.counters[e] < 0 ? -1 : r.counters[e] + run_counters[e];
+            histograms[0].record(ns);
+            total += ns;
+            do_not_optimize(out.data());
+        }
+        for (auto &c: r.counters)
+            c = c < 0 ? c : c / static_cast<int64_t>(runs);
+        r.total_ns = total / runs;
+        r.operations = num_threads; // one range per thread
+        r.values = n;
+        if (!a.matches(data, std::vector<y_t>(out.begin(), out.end())))
+            return false;
+    } else {
+        throw std::runtime_error("unknown workload " + w);
+    }
+
+    for (const auto &h: histograms)
+        r.latency.merge(h);
+    return true;
+}
+
+/* Prints a row and, when comparing against a baseline, keeps its metrics. */
+void emit(const row &r, const options &opts, regression::samples &current) {
+    r.print(std::cout, opts.format);
+    if (!opts.baseline.empty()) {
+        std::ostringstream json;
+        r.print(json, "json");
+        regression::add(current, regression::parse_json_line(json.str()));
+    }
+}
+
+template<typename Adapter>
+bool bench(Adapter a, const std::string &name, const std::filesystem::path &fn, const std::vector<y_t> &data,
+           int64_t bpc, const options &opts, size_t run, regression::samples &current) {
+    namespace memory = pfa::neats::memory;
+    perf_counters counters;
+    pfa::neats::profiling::reset();
+    memory::reset();
+    const auto rss_reset = resident_memory::reset_peak();
+    const auto rss_before = resident_memory::current_bytes();
+    counters.start();
+    auto t1 = std::chrono::steady_clock::now();
+    a.compress(data);
+    auto t2 = std::chrono::steady_clock::now();
+    auto compression_counters = counters.stop();
+    const auto rss_peak = resident_memory::peak_bytes();
+    const auto partitioning_memory = memory::current()[memory::phase::partitioning]; // a copy, load resets it
+    const bool accounted = memory::enabled && !is_baseline(name);
+
+    if (!opts.profile.empty()) {
+        std::ofstream out(opts.profile, std::ios::app);
+        const auto &p = pfa::neats::profiling::current();
+        const auto prefix = name + "," + fn.filename().string() + "," + std::to_string(data.size()) + ","
+                            + std::to_string(bpc) + ",";
+        for (size_t i = 0; i < p.phases.size(); ++i)
+            out << prefix << pfa::neats::profiling::phase_names[i] << "," << p.phases[i].calls << ","
+                << p.phases[i].ns << "," << p.phases[i].self_ns << std::endl;
+        for (size_t i = 0; i < p.counters.size(); ++i)
+            out << prefix << pfa::neats::profiling::counter_names[i] << "," << p.counters[i] << ",," << std::endl;
+    }
+
+    if (!opts.memory.empty() && !is_baseline(name)) {
+        std::ofstream out(opts.memory, std::ios::app);
+        auto p = memory::current();
+        if constexpr (requires { a.load_profile(); })
+            p.phases[std::to_underlying(memory::phase::load)] = a.load_profile()[memory::phase::load];
+        const auto prefix = name + "," + fn.filename().string() + "," + std::to_string(data.size()) + ","
+                            + std::to_string(bpc) + ",";
+        for (size_t i = 0; i < p.phases.size(); ++i)
+            out << prefix << memory::phase_names[i] << "," << p.phases[i].calls << "," << p.phases[i].allocations
+                << "," << p.phases[i].deallocations << "," << p.phases[i].allocated_bytes << ","
+                << p.phases[i].peak_bytes << "," << p.phases[i].retained_bytes << std::endl;
+    }
+
+    std::vector<y_t> out(data.size());
+    a.decompress(out.data());
+    if (!a.matches(data, out)) {
+        std::cerr << name << " on " << fn << " (bpc " << bpc << "): decompressed data does not match" << std::endl;
+        return false;
+    }
+    if constexpr (requires { a.approx_matches(data); }) {
+        if (!a.approx_matches(data)) {
+            std::cerr << name << " on " << fn << " (bpc " << bpc << "): approximations out of their bounds" << std::endl;
+            return false;
+        }
+    }
+
+    row base;
+    base.compressor = name;
+    base.dataset = fn.filename().string();
+    base.n = data.size();
+    base.bpc = bpc;
+    base.run = run;
+    base.compressed_bits = a.size_in_bits();
+    base.compression_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+    if (rss_reset && rss_before >= 0 && rss_peak >= 0)
+        base.compression_peak_rss_bytes = std::max<int64_t>(0, rss_peak - rss_before);
+    if (accounted) {
+        base.compression_peak_heap_bytes = static_cast<int64_t>(partitioning_memory.peak_bytes);
+        base.compression_allocations = static_cast<int64_t>(partitioning_memory.allocations);
+    }
+
+    auto compression = base;
+    compression.workload = "compress";
+    compression.distribution = "-";
+    compression.operations = 1;
+    compression.values = data.size();
+    compression.total_ns = base.compression_ns;
+    compression.latency.record(base.compression_ns);
+    compression.counters = compression_counters;
+    emit(compression, opts, current);
+
+    for (const auto &w: opts.workloads) {
+        // full decompressions do not depend on the distribution
+        const auto distributions = w.rfind("decompress", 0) == 0 ? std::vector<std::string>{"-"} : opts.distributions;
+        for (const auto &d: distributions) {
+            for (auto th: opts.threads) {
+                auto r = base;
+                r.workload = w;
+                r.distribution = d;
+                r.threads = static_cast<size_t>(std::max<int64_t>(1, th));
+                if (!run_workload(a, data, w, r.threads, opts, r)) {
+                    std::cerr << name << " on " << fn << " (bpc " << bpc << "): " << w << " with " << r.threads
+                              << " threads does not match the data" << std::endl;
+                    return false;
+                }
+                emit(r, opts, current);
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    options opts;
+    try {
+        opts = parse_options(argc, argv);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [--config=file] [--compressors=...] [--datasets=...] [--bpcs=...]"
+                  << " [--workloads=...] [--threads=...] [--distributions=...] [--queries=N] [--warmup=N] [--latency=0|1]"
+                  << " [--first_is_size=0|1] [--format=csv|json]"
+                  << " [--seed=N] [--profile=file] [--memory=file] [--repeat=N] [--baseline=file]"
+                  << " [--tolerance=x] [--bits_tolerance=x]" << std::endl;
+        return 1;
+    }
+    if (opts.datasets.empty()) {
+        std::cerr << "no datasets given (--datasets)" << std::endl;
+        return 1;
+    }
+
+    if (!opts.profile.empty())
+        std::ofstream(opts.profile) << "compressor,dataset,n,bpc,phase,calls,ns,self_ns" << std::endl;
+    if (!opts.memory.empty())
+        std::ofstream(opts.memory) << "compressor,dataset,n,bpc,phase,calls,allocations,deallocations,allocated_bytes,"
+                                   << "peak_bytes,retained_bytes" << std::endl;
+    // read before the runs, so that a missing baseline does not waste them
+    regression::samples baseline, current;
+    if (!opts.baseline.empty()) {
+        try {
+            baseline = regression::collect(regression::read_json_lines(opts.baseline));
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    row::header(std::cout, opts.format);
+    bool ok = true;
+    for (const auto &fn: expand_datasets(opts.datasets)) {
+        std::vector<y_t> raw;
+        try {
+            raw = load_dataset(fn, opts.first_is_size);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            ok = false;
+            continue;
+        }
+
+        // the relative bound refers to the values themselves, so they are shifted only to make them positive
+        auto positive = raw;
+        if (const auto min_raw = *std::min_element(raw.begin(), raw.end()); min_raw <= 0) {
+            for (auto &d: positive)
+                d += 1 - min_raw;
+        }
+
+        for (size_t run = 0; run < opts.repeat; ++run) {
+            for (const auto &name: opts.compressors) {
+                if (is_relative(name)) {
+                    const auto parts = split(name, ':');
+                    const double delta = parts.size() > 1 ? std::stod(parts[1]) : 0.01;
+                    ok &= bench(neats_lossy_adapter(0, delta), name, fn, positive, 0, opts, run, current);
+                    continue;
+                }
+                if (!is_baseline(name))
+                    continue;
+                const auto parts = split(name, ':');
+                const size_t block = parts.size() > 1 ? std::stoull(parts[1]) : 128;
+                if (parts[0] == "for")
+                    ok &= bench(baseline_adapter(std::make_unique<baselines::for_codec>(block)), name, fn, raw, 0,
+                                opts, run, current);
+                else if (parts[0] == "delta")
+                    ok &= bench(baseline_adapter(std::make_unique<baselines::delta_codec>(block)), name, fn, raw, 0,
+                                opts, run, current);
+                else
+                    ok &= bench(baseline_adapter(std::make_unique<baselines::dac_codec>()), name, fn, raw, 0, opts,
+                                run, current);
+            }
+        }
+
+        for (auto bpc: opts.bpcs) {
+            // same preprocessing as the batch pipeline: the minimum is moved above epsilon
+            auto data = raw;
+            auto min_data = *std::min_element(data.begin(), data.end());
+            min_data = min_data < 0 ? (min_data - 1) : -1;
+            const auto shift = min_data - static_cast<int64_t>(BPC_TO_EPSILON(bpc));
+            for (auto &d: data)
+                d -= shift;
+
+            // the runs of the compressors are interleaved, so that a slow phase of the machine hits all of them
+            for (size_t run = 0; run < opts.repeat; ++run) {
+                for (const auto &name: opts.compressors) {
+                    if (name == "neats")
+                        ok &= bench(neats_adapter(bpc, false, false), name, fn, data, bpc, opts, run, current);
+                    else if (name == "neats_quantized")
+                        ok &= bench(neats_adapter(bpc, true, false), name, fn, data, bpc, opts, run, current);
+                    else if (name == "neats_patched")
+                        ok &= bench(neats_adapter(bpc, false, true), name, fn, data, bpc, opts, run, current);
+                    else if (name == "neats_lossy")
+                        ok &= bench(neats_lossy_adapter(bpc), name, fn, data, bpc, opts, run, current);
+                    else if (!is_baseline(name) && !is_relative(name) && run == 0) {
+                        std::cerr << "unknown compressor " << name << std::endl;
+                        ok = false;
+                    }
+                }
+            }
+        }
+    }
+    if (!ok)
+        return 2;
+
+    if (!opts.baseline.empty()) {
+        const auto findings = regression::compare(baseline, current, opts.tolerances);
+        regression::finding::header(std::cerr);
+        size_t regressions = 0;
+        for (const auto &f: findings) {
+            f.print(std::cerr);
+            regressions += f.status == "regression";
+        }
+        std::cerr << regressions << " regressions in " << findings.size() << " comparisons against "
+                  << opts.baseline << std::endl;
+        if (regressions > 0)
+            return 3;
+    }
+    return 0;
+}
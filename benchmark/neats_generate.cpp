@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "synthetic_series.hpp"
+
+/* Writes synthetic series (see synthetic_series.hpp) as .bin files in the format read by the benchmarks: the number of
+ * values (size_t) followed by the values (int64_t).
+ *
+ *   neats_generate <out_dir> <spec> [spec ...]      e.g. neats_generate data mixed:n=1000000 uniform:seed=3
+ *   neats_generate <out_dir> all [n] [seed]         one series of every kind
+ *
+ * Each file is named after its spec, with ':' replaced by '_'. */
+
+std::string file_name(const synthetic::spec &sp) {
+    auto name = sp.to_string();
+    for (auto &c: name) {
+        if (c == ':')
+            c = '_';
+    }
+    return name + ".bin";
+}
+
+void write_series(const std::filesystem::path &fn, const std::vector<int64_t> &data) {
+    std::ofstream out(fn, std::ios::binary);
+    const size_t size = data.size();
+    out.write(reinterpret_cast<const char *>(&size), sizeof(size_t));
+    out.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(size * sizeof(int64_t)));
+    if (!out)
+        throw std::runtime_error("cannot write " + fn.string());
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <out_dir> <spec> [spec ...] | <out_dir> all [n] [seed]" << std::endl;
+        std::cerr << "spec: kind[:key=value]..., kind in";
+        for (const auto &k: synthetic::kinds())
+            std::cerr << " " << k;
+        std::cerr << std::endl << "keys: n seed noise min_len max_len level amplitude step period spike_rate spike"
+                  << std::endl;
+        return 1;
+    }
+
+    const std::filesystem::path out_dir = argv[1];
+    std::vector<synthetic::spec> specs;
+    try {
+        if (std::string(argv[2]) == "all") {
+            for (const auto &k: synthetic::kinds()) {
+                synthetic::spec sp;
+                sp.kind = k;
+                if (argc > 3) sp.n = std::stoull(argv[3]);
+                if (argc > 4) sp.seed = std::stoull(argv[4]);
+                specs.push_back(sp);
+            }
+        } else {
+            for (int i = 2; i < argc; ++i)
+                specs.push_back(synthetic::parse_spec(argv[i]));
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::filesystem::create_directories(out_dir);
+    std::cout << "file,n,min,max" << std::endl;
+    for (const auto &sp: specs) {
+        const auto data = synthetic::generate(sp);
+        const auto fn = out_dir / file_name(sp);
+        try {
+            write_series(fn, data);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 2;
+        }
+        const auto [lo, hi] = std::minmax_element(data.begin(), data.end());
+        std::cout << fn.string() << "," << data.size() << "," << (data.empty() ? 0 : *lo) << ","
+                  << (data.empty() ? 0 : *hi) << std::endl;
+    }
+    return 0;
+}
@@ -85,7 +85,7 @@ template<typename T>
 auto full_decompression_time(const auto &compressor, uint32_t num_runs = 1) {
     size_t res = 0;
     for (auto i = 0; i < num_runs; ++i) {
-        std::vector<T> decompressed(compressor.size());
+        pfa::neats::huge_pages::vector<T> decompressed(compressor.size());
         auto t1 = std::chrono::high_resolution_clock::now();
         compressor.decompress(decompressed.begin(), decompressed.end());
         auto t2 = std::chrono::high_resolution_clock::now();
@@ -469,7 +469,7 @@ void test_run(const std::string &full_fn, bool header = false) {
     auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
 
 //
-    std::vector<TypeOut> decompressed(processed_data.size());
+    pfa::neats::huge_pages::vector<TypeOut> decompressed(processed_data.size());
     lc.decompress(decompressed.begin(), decompressed.end());
 
     for (auto i = 0; i < processed_data.size(); ++i) {
@@ -507,7 +507,7 @@ void test_run(const std::string &full_fn, bool header = false) {
     auto num_runs = 50;
     auto t1 = std::chrono::high_resolution_clock::now();
     for (auto r = 0; r < num_runs; ++r) {
-        std::vector<int64_t> decompressed_SIMD(processed_data.size());
+        pfa::neats::huge_pages::vector<int64_t> decompressed_SIMD(processed_data.size());
         lc.decompress_SIMD(decompressed_SIMD.data());
         do_not_optimize(decompressed);
     }
@@ -515,7 +515,7 @@ void test_run(const std::string &full_fn, bool header = false) {
     auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count() / num_runs;
     std::cout << time << std::endl;
 
-    std::vector<int64_t> decompressed_SIMD(processed_data.size());
+    pfa::neats::huge_pages::vector<int64_t> decompressed_SIMD(processed_data.size());
     lc.decompress_SIMD(decompressed_SIMD.data());
 
 
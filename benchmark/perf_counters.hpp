@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* Hardware counters of the calling thread and of the threads it creates while they are enabled, read with
+ * perf_event_open. Each event is opened on its own, so that a missing one (e.g. no LLC event in a VM) does not disable
+ * the others; the events that cannot be opened (perf_event_paranoid > 2, containers, non-Linux systems) read as -1.
+ * The counts of the threads are added to the creating thread when they exit, so they must be joined before stop(). */
+class perf_counters {
+public:
+
+    enum event : size_t {
+        cycles, instructions, l1d_misses, llc_misses, dtlb_misses, branch_misses, num_events
+    };
+
+    static constexpr std::array<const char *, num_events> names{
+            "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "branch_misses"};
+
+    using values_t = std::array<int64_t, num_events>;
+
+private:
+
+    std::array<int, num_events> fds{};
+
+#if defined(__linux__)
+    static int open_event(uint32_t type, uint64_t config) {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    static constexpr uint64_t cache_event(uint64_t cache, uint64_t op, uint64_t result) {
+        return cache | (op << 8) | (result << 16);
+    }
+#endif
+
+public:
+
+    perf_counters() {
+        fds.fill(-1);
+#if defined(__linux__)
+        fds[cycles] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        fds[instructions] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        fds[l1d_misses] = open_event(PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_L1D,
+                                                                     PERF_COUNT_HW_CACHE_OP_READ,
+                                                                     PERF_COUNT_HW_CACHE_RESULT_MISS));
+        fds[llc_misses] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        fds[dtlb_misses] = open_event(PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_DTLB,
+                                                                      PERF_COUNT_HW_CACHE_OP_READ,
+                                                                      PERF_COUNT_HW_CACHE_RESULT_MISS));
+        fds[branch_misses] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+    }
+
+    perf_counters(const perf_counters &) = delete;
+
+    perf_counters &operator=(const perf_counters &) = delete;
+
+    ~perf_counters() {
+#if defined(__linux__)
+        for (auto fd: fds) {
+            if (fd >= 0)
+                close(fd);
+        }
+#endif
+    }
+
+    [[nodiscard]] bool available(event e) const {
+        return fds[e] >= 0;
+    }
+
+    void start() const {
+#if defined(__linux__)
+        for (auto fd: fds) {
+            if (fd < 0)
+                continue;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    [[nodiscard]] values_t stop() const {
+        values_t res;
+        res.fill(-1);
+#if defined(__linux__)
+        for (size_t e = 0; e < num_events; ++e) {
+            if (fds[e] < 0)
+                continue;
+            ioctl(fds[e], PERF_EVENT_IOC_DISABLE, 0);
+            int64_t count = 0;
+            if (read(fds[e], &count, sizeof(count)) == sizeof(count))
+                res[e] = count;
+        }
+#endif
+        return res;
+    }
+};
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+/* Comparison of benchmark results against a stored baseline, both as the JSON lines of neats_bench (one flat object
+ * per row). The rows are grouped by compressor, dataset, bpc, threads, workload and distribution, and each group gives
+ * the samples (one per run, see --repeat) of the metrics tracked by the gate:
+ *
+ *   compression_mb_per_s    compress rows, input bytes per second                      higher is better
+ *   bits_per_value          compress rows                                              lower is better
+ *   decompression_mb_per_s  decompress rows, decoded bytes per second                  higher is better
+ *   p99_ns                  ra rows, 99th percentile latency of a random access        lower is better
+ *
+ * A metric regresses when it is worse than the baseline by more than the tolerance (relative to the baseline mean)
+ * and the difference is significant: the 95% confidence interval of the difference of the means (Welch's t-test)
+ * does not contain zero. With a single run on a side the variance of the timings is unknown, so they are reported as
+ * insufficient_runs and never fail the gate: use at least 3 runs. bits_per_value is deterministic, so a single run
+ * suffices, and has its own, tighter tolerance. */
+namespace regression {
+
+    using record = std::map<std::string, std::string>;
+
+    /** Parses a flat JSON object of string and number values, as written by neats_bench. */
+    inline record parse_json_line(const std::string &line) {
+        record r;
+        size_t i = 0;
+        auto skip = [&] {
+            while (i < line.size() && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r'))
+                ++i;
+        };
+        auto expect = [&](char c) {
+            skip();
+            if (i >= line.size() || line[i] != c)
+                throw std::runtime_error("malformed JSON line: " + line);
+            ++i;
+        };
+        auto string = [&] {
+            expect('"');
+            std::string s;
+            while (i < line.size() && line[i] != '"') {
+                if (line[i] == '\\' && i + 1 < line.size())
+                    ++i;
+                s += line[i++];
+            }
+            expect('"');
+            return s;
+        };
+
+        expect('{');
+        skip();
+        if (i < line.size() && line[i] == '}')
+            return r;
+        while (true) {
+            auto key = string();
+            expect(':');
+            skip();
+            if (i < line.size() && line[i] == '"') {
+                r[key] = string();
+            } else {
+                const auto e = line.find_first_of(",}", i);
+                if (e == std::string::npos)
+                    throw std::runtime_error("malformed JSON line: " + line);
+                auto v = line.substr(i, e - i);
+                v.erase(v.find_last_not_of(" \t\r") + 1);
+                r[key] = v;
+                i = e;
+            }
+            skip();
+            if (i < line.size() && line[i] == ',') {
+                ++i;
+                continue;
+            }
+            expect('}');
+            return r;
+        }
+    }
+
+    /** Reads the JSON lines of a neats_bench run, skipping everything else (e.g. a CSV header). */
+    inline std::vector<record> read_json_lines(const std::string &fn) {
+        std::ifstream in(fn);
+        if (!in)
+            throw std::runtime_error("cannot open " + fn);
+        std::vector<record> rows;
+        std::string line;
+        while (std::getline(in, line)) {
+            const auto b = line.find_first_not_of(" \t");
+            if (b != std::string::npos && line[b] == '{')
+                rows.push_back(parse_json_line(line.substr(b)));
+        }
+        return rows;
+    }
+
+    struct metric {
+        const char *name;
+        bool higher_is_better;
+        bool deterministic; // compared with the bits tolerance
+    };
+
+    inline constexpr metric compression_speed{"compression_mb_per_s", true, false};
+    inline constexpr metric compressed_size{"bits_per_value", false, true};
+    inline constexpr metric decompression_speed{"decompression_mb_per_s", true, false};
+    inline constexpr metric ra_p99{"p99_ns", false, false};
+
+    inline constexpr std::array<metric, 4> metrics{compression_speed, compressed_size, decompression_speed, ra_p99};
+
+    using group_key = std::tuple<std::string, std::string, std::string, std::string, std::string, std::string>;
+
+    /* compressor, dataset, bpc, threads, workload, distribution; metric name -> samples */
+    using samples = std::map<group_key, std::map<std::string, std::vector<double>>>;
+
+    inline double number(const record &r, const std::string &key) {
+        auto it = r.find(key);
+        if (it == r.end())
+            throw std::runtime_error("missing field " + key + " in a benchmark row");
+        return std::stod(it->second);
+    }
+
+    inline std::string field(const record &r, const std::string &key) {
+        auto it = r.find(key);
+        return it == r.end() ? std::string{} : it->second;
+    }
+
+    /** Adds the metrics of a row to its group, if it has any. */
+    inline void add(samples &s, const record &r) {
+        const auto workload = field(r, "workload");
+        const group_key key{field(r, "compressor"), field(r, "dataset"), field(r, "bpc"), field(r, "threads"),
+                            workload, field(r, "distribution")};
+        if (workload == "compress") {
+            const auto ns = number(r, "compression_ns");
+            if (ns > 0)
+                s[key][compression_speed.name].push_back(number(r, "n") * 8 * 1e3 / ns);
+            s[key][compressed_size.name].push_back(number(r, "bits_per_value"));
+        } else if (workload.rfind("decompress", 0) == 0) {
+            s[key][decompression_speed.name].push_back(number(r, "mvalues_per_s") * 8);
+        } else if (workload == "ra" || workload.rfind("ra:", 0) == 0) {
+            s[key][ra_p99.name].push_back(number(r, "p99_ns"));
+        }
+    }
+
+    inline samples collect(const std::vector<record> &rows) {
+        samples s;
+        for (const auto &r: rows)
+            add(s, r);
+        return s;
+    }
+
+    /** The 0.975 quantile of Student's t distribution with df degrees of freedom. */
+    inline double t_quantile(double df) {
+        static constexpr double table[]{12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+        if (df < 1)
+            return table[0];
+        if (df <= 30)
+            return table[static_cast<size_t>(df) - 1];
+        return 1.96 + 2.37 / df; // within 0.002 of the exact quantile
+    }
+
+    struct summary {
+        size_t n = 0;
+        double mean = 0;
+        double variance = 0; // of the samples, 0 with a single one
+
+        explicit summary(const std::vector<double> &v) : n{v.size()} {
+            for (auto x: v)
+                mean += x;
+            mean /= static_cast<double>(std::max<size_t>(1, n));
+            if (n > 1) {
+                for (auto x: v)
+                    variance += (x - mean) * (x - mean);
+                variance /= static_cast<double>(n - 1);
+            }
+        }
+
+        /** Half-width of the 95% confidence interval of the mean. */
+        [[nodiscard]] double ci() const {
+            return n > 1 ? t_quantile(static_cast<double>(n - 1)) * std::sqrt(variance / static_cast<double>(n)) : 0.0;
+        }
+    };
+
+    /** Half-width of the 95% confidence interval of the difference of the means (Welch). */
+    inline double difference_ci(const summary &a, const summary &b) {
+        const auto va = a.variance / static_cast<double>(a.n);
+        const auto vb = b.variance / static_cast<double>(b.n);
+        const auto se2 = va + vb;
+        if (se2 == 0)
+            return 0;
+        const auto da = a.n > 1 ? va * va / static_cast<double>(a.n - 1) : 0.0;
+        const auto db = b.n > 1 ? vb * vb / static_cast<double>(b.n - 1) : 0.0;
+        const auto df = da + db > 0 ? se2 * se2 / (da + db) : 1.0;
+        return t_quantile(df) * std::sqrt(se2);
+    }
+
+    struct finding {
+        group_key key;
+        std::string metric;
+        summary baseline;
+        summary current;
+        double change;      // relative change of the mean, positive when worse
+        bool significant;
+        std::string status; // regression, improvement, within_tolerance, not_significant, unchanged, insufficient_runs
+
+        static void header(std::ostream &os) {
+            os << "compressor,dataset,bpc,threads,workload,distribution,metric,baseline_runs,baseline_mean,"
+               << "baseline_ci,current_runs,current_mean,current_ci,worse_by,significant,status" << std::endl;
+        }
+
+        void print(std::ostream &os) const {
+            const auto &[c, d, bpc, th, w, dist] = key;
+            os << c << "," << d << "," << bpc << "," << th << "," << w << "," << dist << "," << metric << ","
+               << baseline.n << "," << baseline.mean << "," << baseline.ci() << "," << current.n << ","
+               << current.mean << "," << current.ci() << "," << change << "," << significant << "," << status
+               << std::endl;
+        }
+    };
+
+    struct tolerances {
+        double timing = 0.05; // relative, for the speeds and the latencies
+        double bits = 0.001;  // relative, for bits_per_value
+    };
+
+    /** Compares every metric of the current run that also appears in the baseline. */
+    inline std::vector<finding> compare(const samples &baseline, const samples &current, const tolerances &tol) {
+        std::vector<finding> res;
+        for (const auto &[key, by_metric]: current) {
+            auto b = baseline.find(key);
+            if (b == baseline.end())
+                continue;
+            for (const auto &[name, values]: by_metric) {
+                auto bm = b->second.find(name);
+                if (bm == b->second.end() || values.empty() || bm->second.empty())
+                    continue;
+                const auto m = *std::find_if(metrics.begin(), metrics.end(), [&](auto &x) { return x.name == name; });
+                const summary base(bm->second), cur(values);
+                const auto diff = cur.mean - base.mean;
+                const auto worse = m.higher_is_better ? -diff : diff;
+                const auto change = base.mean != 0 ? worse / std::abs(base.mean) : 0.0;
+                const bool significant = (m.deterministic || (base.n > 1 && cur.n > 1)) &&
+                                         std::abs(diff) > difference_ci(base, cur);
+                const auto limit = m.deterministic ? tol.bits : tol.timing;
+
+                std::string status;
+                if (!m.deterministic && (base.n < 2 || cur.n < 2))
+                    status = "insufficient_runs";
+                else if (diff == 0)
+                    status = "unchanged";
+                else if (!significant)
+                    status = "not_significant";
+                else if (change > limit)
+                    status = "regression";
+                else if (change < -limit)
+                    status = "improvement";
+                else
+                    status = "within_tolerance";
+                res.push_back({key, name, base, cur, change, significant, status});
+            }
+        }
+        return res;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+/* Resident memory of the process, read from /proc/self/status: VmRSS (current) and VmHWM (its high-water mark).
+ * reset_peak() brings the high-water mark back to the current RSS (writing 5 to /proc/self/clear_refs, Linux 4.0+), so
+ * that peak_bytes() - the RSS before a phase is the resident memory the phase added. Every function returns -1 (or
+ * false) when the files are not available (non-Linux systems). The RSS only sees the pages actually touched, and the
+ * pages freed and reused within the phase once. */
+namespace resident_memory {
+
+    namespace detail {
+        inline int64_t read_status(const std::string &key) {
+            std::ifstream in("/proc/self/status");
+            std::string line;
+            while (std::getline(in, line)) {
+                if (line.rfind(key, 0) == 0) {
+                    std::istringstream ss(line.substr(key.size()));
+                    int64_t kb = -1;
+                    ss >> kb;
+                    return kb < 0 ? -1 : kb * 1024;
+                }
+            }
+            return -1;
+        }
+    }
+
+    inline int64_t current_bytes() {
+        return detail::read_status("VmRSS:");
+    }
+
+    inline int64_t peak_bytes() {
+        return detail::read_status("VmHWM:");
+    }
+
+    inline bool reset_peak() {
+        std::ofstream out("/proc/self/clear_refs");
+        out << "5";
+        out.flush();
+        return static_cast<bool>(out);
+    }
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numbers>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Synthetic time series with a known structure, so that the compressors can be benchmarked without the datasets of
+ * the paper. A series is described by a spec string `kind[:key=value]...`, e.g. `quadratic:n=1000000:noise=4:seed=7`:
+ *
+ *   linear, quadratic, exponential, sqrt  piecewise trends of that function type, with fragments of length uniform in
+ *                                         [min_len, max_len], joined continuously (the best case for NeaTS)
+ *   mixed                                 piecewise trends, each fragment of a random type among the four above
+ *   random_walk                           y[i] = y[i-1] + N(0, step)
+ *   seasonal                              a daily (period) and a weekly (7 * period) sinusoid around level
+ *   spiky                                 a piecewise linear trend plus rare spikes (exceptions for the patched layout)
+ *   uniform                               uniform values in [level - amplitude, level + amplitude] (the worst case)
+ *
+ * Every kind adds Gaussian noise of standard deviation `noise` and rounds to int64_t. The random numbers come from
+ * splitmix64 and are turned into doubles without the standard distributions, whose output is implementation-defined,
+ * so the random stream is the same everywhere. The series also goes through std::exp, log, sin and cos, which are
+ * not correctly rounded by every math library: the same spec gives the same series on builds that use the same libm
+ * (a last-bit difference can move a value across a rounding boundary elsewhere). */
+namespace synthetic {
+
+    struct spec {
+        std::string kind = "mixed";
+        size_t n = 1000000;
+        uint64_t seed = 42;
+        double noise = 2;          // standard deviation of the Gaussian noise
+        size_t min_len = 256;      // fragment lengths of the piecewise kinds
+        size_t max_len = 4096;
+        double level = 1e6;        // starting (or central) value
+        double amplitude = 1e4;    // change of a trend over a fragment, amplitude of the seasonal and uniform kinds
+        double step = 8;           // standard deviation of the random walk steps
+        size_t period = 1440;      // period of the seasonal kind
+        double spike_rate = 1e-3;  // probability of a spike at each position
+        double spike = 1e6;        // maximum magnitude of the spikes
+
+        /** Returns the spec in the `kind:key=value` form parsed by parse_spec, with the defaults left out. */
+        [[nodiscard]] std::string to_string() const {
+            const spec d{};
+            std::ostringstream os;
+            os << kind;
+            if (n != d.n) os << ":n=" << n;
+            if (seed != d.seed) os << ":seed=" << seed;
+            if (noise != d.noise) os << ":noise=" << noise;
+            if (min_len != d.min_len) os << ":min_len=" << min_len;
+            if (max_len != d.max_len) os << ":max_len=" << max_len;
+            if (level != d.level) os << ":level=" << level;
+            if (amplitude != d.amplitude) os << ":amplitude=" << amplitude;
+            if (step != d.step) os << ":step=" << step;
+            if (period != d.period) os << ":period=" << period;
+            if (spike_rate != d.spike_rate) os << ":spike_rate=" << spike_rate;
+            if (spike != d.spike) os << ":spike=" << spike;
+            return os.str();
+        }
+    };
+
+    inline const std::vector<std::string> &kinds() {
+        static const std::vector<std::string> k{"linear", "quadratic", "exponential", "sqrt", "mixed", "random_walk",
+                                                "seasonal", "spiky", "uniform"};
+        return k;
+    }
+
+    inline spec parse_spec(const std::string &s) {
+        spec res;
+        std::stringstream ss(s);
+        std::string item;
+        std::getline(ss, res.kind, ':');
+        if (std::find(kinds().begin(), kinds().end(), res.kind) == kinds().end())
+            throw std::runtime_error("unknown series kind " + res.kind);
+        while (std::getline(ss, item, ':')) {
+            auto eq = item.find('=');
+            if (eq == std::string::npos)
+                throw std::runtime_error("malformed parameter " + item + " in " + s);
+            const auto key = item.substr(0, eq);
+            const auto value = item.substr(eq + 1);
+            if (key == "n") res.n = std::stoull(value);
+            else if (key == "seed") res.seed = std::stoull(value);
+            else if (key == "noise") res.noise = std::stod(value);
+            else if (key == "min_len") res.min_len = std::stoull(value);
+            else if (key == "max_len") res.max_len = std::stoull(value);
+            else if (key == "level") res.level = std::stod(value);
+            else if (key == "amplitude") res.amplitude = std::stod(value);
+            else if (key == "step") res.step = std::stod(value);
+            else if (key == "period") res.period = std::stoull(value);
+            else if (key == "spike_rate") res.spike_rate = std::stod(value);
+            else if (key == "spike") res.spike = std::stod(value);
+            else throw std::runtime_error("unknown parameter " + key + " in " + s);
+        }
+        if (res.min_len == 0 || res.min_len > res.max_len)
+            throw std::runtime_error("fragment lengths must satisfy 0 < min_len <= max_len");
+        if (res.period == 0)
+            throw std::runtime_error("the period must be positive");
+        return res;
+    }
+
+    /** The splitmix64 generator, with the conversions to the distributions used by the generators. */
+    class splitmix64 {
+        uint64_t state;
+
+    public:
+
+        explicit splitmix64(uint64_t seed) : state{seed} {}
+
+        uint64_t next() {
+            uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+
+        /** Uniform in [0, 1). */
+        double uniform() {
+            return static_cast<double>(next() >> 11) * 0x1.0p-53;
+        }
+
+        /** Uniform in [a, b). */
+        double uniform(double a, double b) {
+            return a + (b - a) * uniform();
+        }
+
+        /** Uniform in [a, b]. */
+        size_t uniform_int(size_t a, size_t b) {
+            return a + static_cast<size_t>(next() % (b - a + 1));
+        }
+
+        /** Standard normal (Box-Muller, the second value is dropped to keep the state simple). */
+        double normal() {
+            const auto u1 = 1.0 - uniform();
+            const auto u2 = uniform();
+            return std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * std::numbers::pi * u2);
+        }
+    };
+
+    namespace detail {
+
+        enum class trend : uint8_t { linear, quadratic, exponential, sqrt };
+
+        /* Appends a fragment of len values of the given type starting from y0, whose values move by about amplitude. */
+        inline void append_trend(trend t, size_t len, double y0, const spec &sp, splitmix64 &rng,
+                                 std::vector<double> &out) {
+            const auto a = rng.uniform(-1, 1) * sp.amplitude;
+            const auto dl = static_cast<double>(len);
+            switch (t) {
+                case trend::linear:
+                    for (size_t x = 0; x < len; ++x)
+                        out.push_back(y0 + a * static_cast<double>(x) / dl);
+                    break;
+                case trend::quadratic: {
+                    // a parabola with its vertex at a random point of the fragment
+                    const auto v = rng.uniform(0, 1) * dl;
+                    for (size_t x = 0; x < len; ++x) {
+                        const auto dx = (static_cast<double>(x) - v) / dl;
+                        out.push_back(y0 + a * (dx * dx - (v / dl) * (v / dl)));
+                    }
+                    break;
+                }
+                case trend::exponential: {
+                    // growth or decay by a factor of at most e over the fragment, always towards the level
+                    const auto c = std::max(y0, 1.0);
+                    const auto r = (c > sp.level ? -1.0 : 1.0) * rng.uniform(0.1, 1) / dl;
+                    for (size_t x = 0; x < len; ++x)
+                        out.push_back(c * std::exp(r * static_cast<double>(x)));
+                    break;
+                }
+                case trend::sqrt:
+                    for (size_t x = 0; x < len; ++x)
+                        out.push_back(y0 + a * std::sqrt(static_cast<double>(x) / dl));
+                    break;
+            }
+        }
+
+        inline std::vector<double> piecewise(const spec &sp, splitmix64 &rng, bool random_type, trend t) {
+            std::vector<double> out;
+            out.reserve(sp.n);
+            auto y = sp.level;
+            while (out.size() < sp.n) {
+                const auto len = std::min(rng.uniform_int(sp.min_len, sp.max_len), sp.n - out.size());
+                const auto ft = random_type ? static_cast<trend>(rng.uniform_int(0, 3)) : t;
+                append_trend(ft, len, y, sp, rng, out);
+                y = out.back();
+                // the trends move away from the level, pull them back so that long series do not drift without bound
+                if (std::abs(y - sp.level) > 10 * sp.amplitude)
+                    y = sp.level + (y > sp.level ? 9 : -9) * sp.amplitude;
+            }
+            return out;
+        }
+    }
+
+    /** Generates the series described by sp. */
+    inline std::vector<int64_t> generate(const spec &sp) {
+        using detail::trend;
+        splitmix64 rng(sp.seed);
+        std::vector<double> v;
+
+        if (sp.kind == "linear") v = detail::piecewise(sp, rng, false, trend::linear);
+        else if (sp.kind == "quadratic") v = detail::piecewise(sp, rng, false, trend::quadratic);
+        else if (sp.kind == "exponential") v = detail::piecewise(sp, rng, false, trend::exponential);
+        else if (sp.kind == "sqrt") v = detail::piecewise(sp, rng, false, trend::sqrt);
+        else if (sp.kind == "mixed") v = detail::piecewise(sp, rng, true, trend::linear);
+        else if (sp.kind == "random_walk") {
+            v.resize(sp.n);
+            auto y = sp.level;
+            for (auto &e: v) {
+                e = y;
+                y += sp.step * rng.normal();
+            }
+        } else if (sp.kind == "seasonal") {
+            v.resize(sp.n);
+            const auto w = 2.0 * std::numbers::pi / static_cast<double>(sp.period);
+            for (size_t i = 0; i < sp.n; ++i) {
+                const auto x = static_cast<double>(i);
+                v[i] = sp.level + sp.amplitude * std::sin(w * x) + 0.3 * sp.amplitude * std::sin(w * x / 7);
+            }
+        } else if (sp.kind == "spiky") {
+            v = detail::piecewise(sp, rng, false, trend::linear);
+            for (auto &e: v) {
+                if (rng.uniform() < sp.spike_rate)
+                    e += (rng.uniform() < 0.5 ? -1 : 1) * rng.uniform(0.5, 1) * sp.spike;
+            }
+        } else if (sp.kind == "uniform") {
+            v.resize(sp.n);
+            for (auto &e: v)
+                e = rng.uniform(sp.level - sp.amplitude, sp.level + sp.amplitude);
+        } else {
+            throw std::runtime_error("unknown series kind " + sp.kind);
+        }
+
+        std::vector<int64_t> res(v.size());
+        for (size_t i = 0; i < v.size(); ++i)
+            res[i] = std::llround(v[i] + (sp.noise > 0 ? sp.noise * rng.normal() : 0.0));
+        return res;
+    }
+
+    inline std::vector<int64_t> generate(const std::string &s) {
+        return generate(parse_spec(s));
+    }
+}
@@ -14,9 +14,12 @@
 #include <memory>      // For std::unique_ptr
 #include <algorithm>   // For std::reverse, std::min
 #include <iterator>    // For std::distance
+#include <compare>     // For std::strong_ordering
+#include <bit>         // For std::bit_width
 #include <fstream>     // For std::ofstream, std::ostream, std::istream
 #include <iomanip>     // For std::setprecision, std::fixed
 #include <sstream>     // For std::stringstream
+#include <spanstream>  // For std::ispanstream
 #include <stdexcept>   // For std::runtime_error
 #include <iostream>    // For std::cerr, std::cout, std::endl (debugging/info)
 #include <utility>     // For std::pair
@@ -38,6 +41,10 @@
 // Project Headers
 #include "float_pfa.hpp"
 #include "my_elias_fano.hpp"
+#include "coefficient_codec.hpp"
+#include "huge_pages.hpp"
+#include "memory_accounting.hpp"
+#include "profiling.hpp"
 
 // --- Portability Aliases and Definitions ---
 
@@ -76,6 +83,101 @@ using float64_alias_t = double; // Replaces float64_alias_t
 namespace pfa::neats {
     // stdx alias already defined globally
 
+    /** Reduction applied to every bucket by compressor::scan_bucketed. */
+    enum class bucket_aggregate : uint8_t {
+        sum, min, max, mean
+    };
+
+    /** Summary of the fragments and of the space of a compressor, computed from its metadata by compressor::stats()
+     * (nothing is decompressed). The per-type arrays are indexed by approx_fun_t (linear, exponential, quadratic,
+     * sqrt), the per-bpc ones by the bpc of the fragments. */
+    struct compressor_stats {
+        static constexpr size_t num_types = 4;
+        static constexpr size_t num_bpcs = 65;
+        static constexpr size_t num_length_buckets = 64;
+
+        size_t n = 0;
+        size_t num_fragments = 0;
+        std::array<size_t, num_types> fragments_per_type{};
+        std::array<size_t, num_bpcs> fragments_per_bpc{};
+        std::array<std::array<size_t, num_bpcs>, num_types> fragments_per_type_bpc{};
+
+        size_t min_length = 0;
+        size_t max_length = 0;
+        std::array<size_t, num_length_buckets> length_histogram{}; // fragments with length in [2^i, 2^(i+1))
+        std::array<size_t, num_types> values_per_type{};
+
+        std::array<size_t, num_types> residual_bits_per_type{}; // exceptions excluded
+        size_t zero_bpc_fragments = 0;
+        size_t zero_bpc_values = 0;
+        size_t patched_fragments = 0;
+        size_t num_exceptions = 0;
+
+        // space, as in size_in_bits(): the parts below plus the indexes (Elias-Fano, rank supports, bpcs, types)
+        size_t total_bits = 0;
+        size_t residual_bits = 0;
+        size_t exception_bits = 0;
+        size_t coefficient_bits = 0;
+        size_t aggregate_bits = 0;
+
+        [[nodiscard]] size_t index_bits() const {
+            return total_bits - residual_bits - exception_bits - coefficient_bits - aggregate_bits;
+        }
+
+        [[nodiscard]] double mean_length() const {
+            return num_fragments ? static_cast<double>(n) / num_fragments : 0.0;
+        }
+
+        [[nodiscard]] double mean_length(size_t type) const {
+            return fragments_per_type[type] ? static_cast<double>(values_per_type[type]) / fragments_per_type[type]
+                                            : 0.0;
+        }
+
+        [[nodiscard]] double zero_bpc_fraction() const {
+            return num_fragments ? static_cast<double>(zero_bpc_fragments) / num_fragments : 0.0;
+        }
+
+        [[nodiscard]] double coefficient_share() const {
+            return total_bits ? static_cast<double>(coefficient_bits) / total_bits : 0.0;
+        }
+
+        [[nodiscard]] double bits_per_value() const {
+            return n ? static_cast<double>(total_bits) / n : 0.0;
+        }
+
+        /** Writes the statistics as `key,value` lines, skipping the empty histogram entries. */
+        void print(std::ostream &os) const {
+            static constexpr std::array<const char *, num_types> types{"linear", "exponential", "quadratic", "sqrt"};
+            os << "n," << n << "\nfragments," << num_fragments << "\nbits_per_value," << bits_per_value()
+               << "\nmean_length," << mean_length() << "\nmin_length," << min_length << "\nmax_length," << max_length
+               << "\nzero_bpc_fraction," << zero_bpc_fraction() << "\nzero_bpc_values," << zero_bpc_values
+               << "\npatched_fragments," << patched_fragments << "\nexceptions," << num_exceptions
+               << "\ntotal_bits," << total_bits << "\nresidual_bits," << residual_bits << "\nexception_bits,"
+               << exception_bits << "\ncoefficient_bits," << coefficient_bits << "\naggregate_bits," << aggregate_bits
+               << "\nindex_bits," << index_bits() << "\ncoefficient_share," << coefficient_share() << "\n";
+            for (size_t t = 0; t < num_types; ++t) {
+                os << types[t] << "_fragments," << fragments_per_type[t] << "\n" << types[t] << "_mean_length,"
+                   << mean_length(t) << "\n" << types[t] << "_residual_bits," << residual_bits_per_type[t] << "\n";
+                for (size_t b = 0; b < num_bpcs; ++b) {
+                    if (fragments_per_type_bpc[t][b])
+                        os << types[t] << "_bpc_" << b << "," << fragments_per_type_bpc[t][b] << "\n";
+                }
+            }
+            for (size_t i = 0; i < num_length_buckets; ++i) {
+                if (length_histogram[i])
+                    os << "length_" << (size_t{1} << i) << "_" << (size_t{2} << i) - 1 << "," << length_histogram[i]
+                       << "\n";
+            }
+            os.flush();
+        }
+    };
+
+    /** Lossless compressor with random access.
+     *
+     * Thread safety: once built (partitioning) or loaded, every const member function (operator[], simd_scan,
+     * simd_decompress, the range queries, the iterators, for_each_fragment, serialize, ...) only reads the compressor,
+     * so any number of threads may call them concurrently on one shared instance without locking. The non-const ones
+     * (partitioning, build_aggregates, assignment) must not overlap with any other call on the same instance. */
     template<typename x_t = uint32_t, typename y_t = int64_t, typename poly = double, typename T1 = float32_alias_t, typename T2 = float64_alias_t>
     class compressor {
         using poa_t = typename pfa::piecewise_optimal_approximation<x_t, y_t, poly, T1, T2>;
@@ -104,6 +206,8 @@ namespace pfa::neats {
         std::vector<std::pair<uint8_t, out_t>> mem_out{};
 
         bool lossy = false;
+        bool quantized = false;
+        bool patched = false;
         uint8_t max_bpc = 32;
         x_t _n = 0;
 
@@ -123,18 +227,120 @@ namespace pfa::neats {
         std::vector<T1> coefficients_t1; // Uses template type T1 (aliased float32_alias_t by default)
         std::vector<T2> coefficients_t2; // Uses template type T2 (aliased float64_alias_t by default)
         std::vector<x_t> coefficients_s; // Uses standard int types
+        coefficient_codec<x_t, T1, T2> coefficients_packed; // replaces the four vectors above when quantized
+
+        // patched residuals: the residual of an exception is stored as eps (i.e. it decodes to 0), and its difference from
+        // the fragment function y - f is kept aside, so that its value is f + exception_at(i)
+        sdsl::bit_vector patched_fragments; // 1 if the fragment has at least one exception
+        MyEliasFano<true> exception_positions; // position + 1 of each exception, preceded by a 0 sentinel
+        sdsl::int_vector<> exception_values; // zigzag-encoded residual of each exception
+
+        // optional per-fragment aggregates of the decoded values, see build_aggregates()
+        bool aggregates = false;
+        y_t aggregates_base = 0; // smallest value, subtracted from fragment_min and fragment_max
+        sdsl::int_vector<64> fragment_sums; // prefix sums (mod 2^64) of the values, one entry per fragment plus one
+        sdsl::int_vector<> fragment_min;
+        sdsl::int_vector<> fragment_max;
+        // sparse tables over the extrema of blocks of aggregates_block fragments: level k holds the minimum (maximum) of
+        // 2^k consecutive blocks. Derived from fragment_min and fragment_max, so they are rebuilt by load
+        static constexpr size_t aggregates_block = 64;
+        std::vector<sdsl::int_vector<>> block_min;
+        std::vector<sdsl::int_vector<>> block_max;
 
         // sdsl rank supports are type-agnostic regarding the underlying bitvector
         sdsl::rank_support_v<1> fun_1_rank;
         sdsl::rank_support_v<1> quad_fun_rank;
 
+#ifdef USE_PROFILING
+        profiling::compression_profile last_profile{}; // of the last partitioning
+#endif
+#ifdef USE_MEMORY_ACCOUNTING
+        memory::allocation_profile last_memory{}; // of the last partitioning or load
+#endif
+
     public:
 
+        using approx_fun_t = typename poa_t::approx_fun_t;
+
+        /** A fragment as passed to for_each_fragment. The values in [start, end) are the function of the given type
+         * and coefficients (see add_approximation; s and t0 are 0 when unused) plus the residuals: the residual of the
+         * position j is the bpc-bit field at bit residual_offset + bpc * (j - start) of residuals_data(), minus
+         * residual_bias. If has_exceptions is true, some positions must also be corrected with exception_at. */
+        struct fragment_view {
+            size_t index;
+            x_t start;
+            x_t end;
+            approx_fun_t type;
+            uint8_t bpc;
+            x_t s;
+            T1 t0;
+            T1 t1;
+            T2 t2;
+            uint64_t residual_offset;
+            y_t residual_bias;
+            bool has_exceptions;
+        };
+
         compressor() = default;
 
-        explicit compressor(auto bpc, bool _lossy = false) : max_bpc{bpc}, lossy{_lossy} {}
+        /** If _quantized is true, every coefficient is stored with the coarsest precision that keeps the residuals of
+         * its fragment within the bpc chosen by the partitioning (see coefficient_codec). If _patched is true, a
+         * fragment may leave a few sparse outliers out of its bpc; they are stored in an exception list (PFOR-style). */
+        explicit compressor(auto bpc, bool _lossy = false, bool _quantized = false, bool _patched = false)
+                : max_bpc{bpc}, lossy{_lossy}, quantized{_quantized}, patched{_patched} {}
+
+        /** Returns (s, t0, t1, t2) of the fragment im, i_s and i_t0 are the ranks of im among the Sqrt and Quadratic
+         * fragments. s and t0 are 0 when the fragment does not use them. */
+        inline std::tuple<x_t, T1, T1, T2> coefficients_at(size_t im, typename poa_t::approx_fun_t mt, size_t i_s,
+                                                           size_t i_t0) const {
+            const bool has_s = mt == poa_t::approx_fun_t::Sqrt;
+            const bool has_t0 = mt == poa_t::approx_fun_t::Quadratic;
+            if (quantized)
+                return coefficients_packed.get(im, has_s, has_t0);
+            return {has_s ? coefficients_s[i_s] : x_t{0}, has_t0 ? coefficients_t0[i_t0] : T1{0},
+                    coefficients_t1[im], coefficients_t2[im]};
+        }
+
+        /** Estimated cost of an exception: its position in the Elias-Fano sequence plus a zigzag value that is, on
+         * average, half a word wide. */
+        [[nodiscard]] size_t exception_size_in_bits() const {
+            return (_n > 1 ? LOG2(_n) : 0) + 2 + sizeof(y_t) * 4;
+        }
 
-        size_t inline weight_ik(auto &&m, auto i = 0, auto k = 0, bool _lossy = false) {
+        /** Asks for huge pages on the structures touched by every access (a no-op unless huge_pages::enabled()). */
+        void advise_huge_pages() const {
+            huge_pages::advise(residuals.data(), sdsl::size_in_bytes(residuals));
+            starting_positions_ef.advise_huge_pages();
+            offset_residuals_ef.advise_huge_pages();
+            if (patched)
+                exception_positions.advise_huge_pages();
+        }
+
+        /** Returns the value to add to the decoded value at position i, 0 if i is not an exception. */
+        inline y_t exception_at(x_t i) const {
+            auto it = exception_positions.predecessor(uint64_t(i) + 1);
+            if (*it != uint64_t(i) + 1)
+                return 0;
+            auto zz = exception_values[it.index() - 1];
+            return static_cast<y_t>(zz >> 1) ^ -static_cast<y_t>(zz & 1);
+        }
+
+        /** Adds the exceptions in [s, e) to out[0, e - s). */
+        template<typename It>
+        inline void apply_exceptions(x_t s, x_t e, It out) const {
+            if (!patched || exception_values.empty())
+                return;
+            auto it = exception_positions.predecessor(s);
+            for (auto r = it.index() + 1; r < exception_positions.size(); ++r) {
+                const auto pos = *(++it) - 1;
+                if (pos >= e)
+                    break;
+                const auto zz = exception_values[r - 1];
+                *(out + (pos - s)) += static_cast<y_t>(zz >> 1) ^ -static_cast<y_t>(zz & 1);
+            }
+        }
+
+        size_t inline weight_ik(auto &&m, auto i = 0, auto k = 0, bool _lossy = false, size_t num_exceptions = 0) {
             if (_lossy) {
                 return std::visit([](auto &&mo) -> size_t {
                     return std::decay_t<decltype(mo)>::fun_t::lossy_size_in_bits();
@@ -145,7 +351,7 @@ namespace pfa::neats {
                 }, m));
                 return std::visit([](auto &&mo) -> size_t { return std::decay_t<decltype(mo)>::fun_t::size_in_bits(); },
                                   m) +
-                       bpc * (k - i); //+ LOG2(_n / 20);
+                       bpc * (k - i) + num_exceptions * exception_size_in_bits(); //+ LOG2(_n / 20);
             }
         };
 
@@ -235,24 +441,28 @@ namespace pfa::neats {
             //sdsl::util::init_support(exp_fun_rank, &model_types);
 
             //sdsl::util::bit_compress(model_types);
+            advise_huge_pages();
             mem_out.clear();
             //mem_out.shrink_to_fit();
         }
 
         template<typename It>
         inline void simd_make_residuals(It in_data) {
+            profiling::scope profile{profiling::phase::make_residuals};
+            memory::scope memory_scope{memory::phase::make_residuals};
             //sdsl::bit_vector starting_positions_bv(_n, 0);
 
             auto num_partitions = mem_out.size();
             residuals = sdsl::int_vector<64>(CEIL_UINT_DIV(residuals_bit_size, 64) + 1, 0);
-            std::vector<uint64_t> starting_positions(num_partitions, 0);
+            memory::vector<uint64_t> starting_positions(num_partitions, 0);
             //starting_positions = sdsl::bit_vector(_n, 0);
             bits_per_correction = sdsl::int_vector<>(num_partitions, 0);
             model_types_0 = sdsl::bit_vector(num_partitions, 0);
             model_types_1 = sdsl::bit_vector(num_partitions, 0);
             qbv = sdsl::bit_vector(num_partitions, 0);
+            memory::account(residuals, bits_per_correction, model_types_0, model_types_1, qbv);
 
-            std::vector<uint64_t> offset_residuals(num_partitions, 0); // minus one because the first offset is 0
+            memory::vector<uint64_t> offset_residuals(num_partitions, 0); // minus one because the first offset is 0
             //auto offset = offset_residuals[0];
 
             auto apply_simd_linear = [](auto x, auto s, floatv_simd_t t0, floatv_simd_t t1, floatv_simd_t t2) -> intv_simd_t {
@@ -295,11 +505,19 @@ namespace pfa::neats {
 
             const floatv_simd_t startv([](int i) { return i + 1; });
 
+            memory::vector<uint64_t> _exception_positions{0};
+            memory::vector<uint64_t> _exception_values;
+            if (patched) {
+                patched_fragments = sdsl::bit_vector(num_partitions, 0);
+                memory::account(patched_fragments);
+            }
+
             for (auto i_model = 0; i_model < mem_out.size(); ++i_model) {
                 auto [bpc, model] = mem_out[i_model];
                 end = i_model == (mem_out.size() - 1) ? _n : std::visit([&](auto &&mo) -> x_t { return mo.get_start(); }, mem_out[i_model + 1].second);
 
                 int64_t eps = (bpc != 0) ? BPC_TO_EPSILON(bpc) + 1 : 0;
+                const int64_t max_err = (bpc != 0) ? 2 * eps - 1 : 0;
                 intv_simd_t epsv{eps};
                 bits_per_correction[i_model] = bpc;
                 starting_positions[i_model] = start;
@@ -308,10 +526,8 @@ namespace pfa::neats {
                 auto t = std::visit([&](auto&& mo) -> auto {return mo.parameters();}, model);
                 auto t1 = std::get<2>(t);
                 auto t2 = std::get<3>(t);
-                coefficients_t1.emplace_back(t1);
-                coefficients_t2.emplace_back(t2);
-                x_t s;
-                float_scalar_t t0;
+                x_t s{0};
+                float_scalar_t t0{0};
 
                 std::size_t num_residuals = end - start;
                 intv_simd_t _y, y, error;
@@ -320,8 +536,6 @@ namespace pfa::neats {
                 std::function<intv_simd_t(floatv_simd_t, floatv_simd_t, floatv_simd_t, floatv_simd_t, floatv_simd_t)> simd_op;
                 std::function<int_scalar_t(float_scalar_t, float_scalar_t, float_scalar_t, float_scalar_t, float_scalar_t)> op;
 
-                t1v = floatv_simd_t{t1};
-                t2v = floatv_simd_t{t2};
                 switch (mt) {
                     case poa_t::approx_fun_t::Linear: {
                         simd_op = apply_simd_linear;
@@ -332,8 +546,6 @@ namespace pfa::neats {
                         simd_op = apply_simd_quadratic;
                         op = apply_quadratic;
                         t0 = std::get<1>(t).value();
-                        coefficients_t0.emplace_back(t0);
-                        t0v = floatv_simd_t{t0};
                         qbv[i_model] = 1;
                         break;
                     }
@@ -341,7 +553,6 @@ namespace pfa::neats {
                         simd_op = apply_simd_radical;
                         op = apply_radical;
                         s = std::get<0>(t).value();
-                        coefficients_s.emplace_back(s);
                         sv = floatv_simd_t{static_cast<float_scalar_t>(s)};
                         break;
                     }
@@ -352,6 +563,60 @@ namespace pfa::neats {
                     }
                 }
 
+                if (quantized) {
+                    // the residuals are computed exactly as below, so the quantized coefficients are accepted only
+                    // if they do not produce more residuals out of [0, max_err] (i.e. exceptions) than the exact ones
+                    auto out_of_range = [&](std::optional<T1> q0, T1 q1, T2 q2, size_t limit) -> size_t {
+                        const float_scalar_t _t0 = q0.has_value() ? *q0 : float_scalar_t{0};
+                        const floatv_simd_t _t0v{_t0}, _t1v{static_cast<float_scalar_t>(q1)}, _t2v{static_cast<float_scalar_t>(q2)};
+                        size_t count = 0;
+                        size_t j = 0;
+                        for (; j + simd_width <= num_residuals && count <= limit; j += simd_width) {
+                            y.copy_from(&(*(in_data + j)), stdx::element_aligned);
+                            error = (y - simd_op(startv + static_cast<float_scalar_t>(j), sv, _t0v, _t1v, _t2v)) + epsv;
+                            count += stdx::popcount(error < 0 || error > max_err);
+                        }
+                        for (; j < num_residuals && count <= limit; ++j) {
+                            auto err = (*(in_data + j) - op(j + 1, s, _t0, q1, q2)) + eps;
+                            count += err < 0 || err > max_err;
+                        }
+                        return count;
+                    };
+                    auto exact_q0 = mt == poa_t::approx_fun_t::Quadratic ? std::get<1>(t) : std::nullopt;
+                    const auto max_exceptions = patched ? out_of_range(exact_q0, t1, t2, num_residuals) : 0;
+                    auto fits = [&](std::optional<T1> q0, T1 q1, T2 q2) -> bool {
+                        return out_of_range(q0, q1, q2, max_exceptions) <= max_exceptions;
+                    };
+
+                    auto q0 = exact_q0;
+                    auto qs = mt == poa_t::approx_fun_t::Sqrt ? std::get<0>(t) : std::nullopt;
+                    auto p = coefficients_packed.fit(q0, t1, t2, fits);
+                    auto [_s, _t0, _t1, _t2] = coefficients_packed.append(qs, q0, t1, t2, p);
+                    t1 = _t1;
+                    t2 = _t2;
+                    if (_t0.has_value()) t0 = *_t0;
+                } else {
+                    coefficients_t1.emplace_back(t1);
+                    coefficients_t2.emplace_back(t2);
+                    if (mt == poa_t::approx_fun_t::Quadratic) coefficients_t0.emplace_back(t0);
+                    if (mt == poa_t::approx_fun_t::Sqrt) coefficients_s.emplace_back(s);
+                }
+
+                t0v = floatv_simd_t{t0};
+                t1v = floatv_simd_t{t1};
+                t2v = floatv_simd_t{t2};
+
+                // an out of range residual is stored as eps, which decodes to 0, and y - f is moved to the exception list
+                auto patch = [&](x_t j, int64_t err) -> uint64_t {
+                    if (!patched || (err >= 0 && err <= max_err))
+                        return static_cast<uint64_t>(err);
+                    _exception_positions.push_back(start + j + 1);
+                    const auto r = err - eps;
+                    _exception_values.push_back((static_cast<uint64_t>(r) << 1) ^ static_cast<uint64_t>(r >> 63));
+                    patched_fragments[i_model] = 1;
+                    return static_cast<uint64_t>(eps);
+                };
+
                 auto j{0};
                 for (; j + simd_width <= num_residuals; j += simd_width) {
                     y.copy_from(&(*(in_data + j)), stdx::element_aligned);
@@ -359,7 +624,7 @@ namespace pfa::neats {
                     error = (y - _y) + epsv;
 
                     for (auto i{0}; i < simd_width; ++i) {
-                        auto err = static_cast<uint64_t>(error[i]);
+                        auto err = patch(j + i, error[i]);
                         sdsl::bits::write_int(residuals.data() + (offset_res >> 6u), err, offset_res & 0x3F,
                                               bpc);
                         offset_res += bpc;
@@ -370,7 +635,7 @@ namespace pfa::neats {
                     auto _y_st = op(j + 1, s, t0, t1, t2);
                     auto y_st = *(in_data + j);
 
-                    auto err = static_cast<uint64_t>((y_st - _y_st) + eps);
+                    auto err = patch(j, (y_st - _y_st) + eps);
                     sdsl::bits::write_int(residuals.data() + (offset_res >> 6u), err, offset_res & 0x3F, bpc);
                     offset_res += bpc;
                 }
@@ -382,30 +647,97 @@ namespace pfa::neats {
                 in_data += num_residuals;
             }
 
+            profiling::scope index_profile{profiling::phase::index_construction};
             starting_positions_ef = MyEliasFano<true>(starting_positions);
             offset_residuals_ef = MyEliasFano<false>(offset_residuals);
-            sdsl::util::bit_compress(bits_per_correction);
+            memory::account(starting_positions_ef, offset_residuals_ef);
+            memory::bit_compress(bits_per_correction);
 
             sdsl::util::init_support(fun_1_rank, &model_types_1);
             sdsl::util::init_support(quad_fun_rank, &qbv);
+            memory::account(fun_1_rank, quad_fun_rank);
+            if (quantized) {
+                coefficients_packed.finish();
+                memory::account(coefficients_packed);
+            } else {
+                memory::account(coefficients_t0, coefficients_t1, coefficients_t2, coefficients_s);
+            }
+            if (patched) {
+                exception_positions = MyEliasFano<true>(_exception_positions);
+                exception_values = sdsl::int_vector<>(_exception_values.size(), 0, 64);
+                std::copy(_exception_values.begin(), _exception_values.end(), exception_values.begin());
+                memory::account(exception_positions, exception_values);
+                memory::bit_compress(exception_values);
+            }
 
+            advise_huge_pages();
             mem_out.clear();
         }
 
         // from begin to end the data is already "normalized" (i.e. > 0)
         template<typename It>
         inline void partitioning(It begin, It end) {
+            profiling::reset();
+            memory::reset();
+            {
+                profiling::scope profile{profiling::phase::partitioning};
+                memory::scope memory_scope{memory::phase::partitioning};
+                build_partitioning(begin, end);
+            }
+#ifdef USE_PROFILING
+            last_profile = profiling::current();
+#endif
+#ifdef USE_MEMORY_ACCOUNTING
+            last_memory = memory::current();
+#endif
+        }
+
+        /** Where partitioning spent its time, see profiling.hpp. Compiled in only with ENABLE_PROFILING (USE_PROFILING),
+         * otherwise every entry is zero (see profiling::enabled). */
+        [[nodiscard]] const profiling::compression_profile &profile() const {
+#ifdef USE_PROFILING
+            return last_profile;
+#else
+            static constexpr profiling::compression_profile zero{};
+            return zero;
+#endif
+        }
+
+        /** The allocations and the peak heap usage of the last partitioning, or of load for a loaded compressor, see
+         * memory_accounting.hpp. Compiled in only with ENABLE_MEMORY_ACCOUNTING (USE_MEMORY_ACCOUNTING), otherwise
+         * every entry is zero (see memory::enabled). */
+        [[nodiscard]] const memory::allocation_profile &memory_profile() const {
+#ifdef USE_MEMORY_ACCOUNTING
+            return last_memory;
+#else
+            static constexpr memory::allocation_profile zero{};
+            return zero;
+#endif
+        }
+
+    private:
+
+        template<typename It>
+        inline void build_partitioning(It begin, It end) {
             const auto n = std::distance(begin, end);
 
             _n = n;
-            std::vector<int64_t> distance(n + 1, std::numeric_limits<int64_t>::max());
-            auto nrows = std::to_underlying(poa_t::approx_fun_t::COUNT); // cols
+            memory::vector<int64_t> distance(n + 1, std::numeric_limits<int64_t>::max());
+            // with patched residuals every model also has a variant that admits exceptions (the rows after COUNT)
+            constexpr auto nfuns = std::to_underlying(poa_t::approx_fun_t::COUNT);
+            size_t nrows = nfuns * (patched ? 2 : 1); // cols
             auto ncols = max_bpc <= 1 ? size_t{1} : size_t{max_bpc}; // rows
             auto nmodels = ncols * nrows;
-            std::vector<std::pair<std::make_signed_t<x_t>, std::make_signed_t<x_t>>> frontier(nmodels, {0, 0});
-
-            std::vector<out_t> local_partitions(nmodels);
-            std::vector<std::pair<uint8_t, std::unique_ptr<out_t>>> previous(n + 1);
+            memory::vector<std::pair<std::make_signed_t<x_t>, std::make_signed_t<x_t>>> frontier(nmodels, {0, 0});
+
+            memory::vector<out_t> local_partitions(nmodels);
+            memory::vector<std::vector<uint32_t>> exceptions(nmodels); // of the segment in local_partitions
+            auto count_exceptions = [&](size_t im, auto i, auto k) -> size_t {
+                if (!patched) return 0;
+                const auto &e = exceptions[im];
+                return std::lower_bound(e.begin(), e.end(), k) - std::lower_bound(e.begin(), e.end(), i);
+            };
+            memory::vector<std::pair<uint8_t, memory::unique_ptr<out_t>>> previous(n + 1);
 
             polygon_t g{};
             distance[0] = 0;
@@ -415,11 +747,12 @@ namespace pfa::neats {
             // [[pla-0, pla-2, ..., pla-max_bpc],
             // [pea-0, pea-2, ..., pea-max_bpc],
             // [pqa-0, pqa-2, ..., pqa-max_bpc],
-            // [psa-0, psa-2, ..., psa-max_bpc]]
+            // [psa-0, psa-2, ..., psa-max_bpc],
+            // (the same four rows again if patched)]
 
             // bpcs
             for (size_t row = 0; row < nrows; ++row) {
-                auto model_type = (typename poa_t::approx_fun_t) (row);
+                auto model_type = (typename poa_t::approx_fun_t) (row % nfuns);
                 // model types...
                 for (size_t col = 0; col < ncols; ++col) {
                     auto im = col + row * ncols;
@@ -429,14 +762,19 @@ namespace pfa::neats {
             }
 
             for (auto k = 0; k < _n; ++k) {
+                // make_segment and the allocations are nested scopes, so only the relaxations are left in its self time
+                profiling::scope relaxations_profile{profiling::phase::relaxations};
                 for (size_t row = 0; row < nrows; ++row) {
                     for (size_t col = 0; col < ncols; ++col) {
                         auto im = col + row * ncols;
 
                         if (frontier[im].second <= k) {
+                            profiling::scope segment_profile{
+                                    static_cast<profiling::phase>(row % nfuns)}; // make_segment_<approx_fun_t>
                             auto t = std::visit([&](auto &&model) -> std::tuple<x_t, x_t, out_t> {
                                 return pfa::algorithm::make_segment<poa_t>(model, g, (begin + k), end,
-                                                                           frontier[im].second);
+                                                                           frontier[im].second,
+                                                                           row >= nfuns ? &exceptions[im] : nullptr);
                             }, m[im]);
 
                             frontier[im].first = std::get<0>(t);
@@ -448,11 +786,14 @@ namespace pfa::neats {
                             auto bpc = pfa::algorithm::epsilon_to_bpc(std::visit([](auto &&mod) -> int64_t {
                                 return mod.epsilon;
                             }, m[im]));
-                            auto wik = weight_ik(m[im], i, k, lossy);
+                            auto wik = weight_ik(m[im], i, k, lossy, count_exceptions(im, i, k));
+                            profiling::count(profiling::counter::edges_relaxed);
 
                             if (distance[k] > distance[i] + wik) {
                                 distance[k] = distance[i] + wik;
-                                previous[k] = std::make_pair(bpc, std::make_unique<out_t>(local_partitions[im]));
+                                profiling::count(profiling::counter::distance_improvements);
+                                profiling::scope allocation_profile{profiling::phase::previous_allocations};
+                                previous[k] = std::make_pair(bpc, memory::make_unique<out_t>(local_partitions[im]));
                             }
                         }
                     }
@@ -466,12 +807,15 @@ namespace pfa::neats {
                         auto bpc = pfa::algorithm::epsilon_to_bpc(std::visit([](auto &&mod) -> int64_t {
                             return mod.epsilon;
                         }, m[im]));
-                        auto wkj = weight_ik(m[im], k, j, lossy);
+                        auto wkj = weight_ik(m[im], k, j, lossy, count_exceptions(im, k, j));
+                        profiling::count(profiling::counter::edges_relaxed);
 
                         if (distance[j] > distance[k] + wkj) {
                             distance[j] = distance[k] + wkj;
+                            profiling::count(profiling::counter::distance_improvements);
+                            profiling::scope allocation_profile{profiling::phase::previous_allocations};
                             std::visit([&](auto &&p) {
-                                previous[j] = std::make_pair(bpc, std::make_unique<out_t>(p.copy(k)));
+                                previous[j] = std::make_pair(bpc, memory::make_unique<out_t>(p.copy(k)));
                             }, local_partitions[im]);
                         }
 
@@ -480,21 +824,29 @@ namespace pfa::neats {
             }
 
             //auto k = std::visit([](auto &&mo) { return mo.get_start(); }, local_partitions[num_models - 1]);
-            auto k = n;
-            while (k != 0) {
-                auto bpc = previous[k].first;
-                auto &f = previous[k].second;
-                mem_out.emplace_back(bpc, *f);
-                auto kp = std::visit([](auto &&mo) -> x_t { return mo.get_start(); }, *f);
-                residuals_bit_size += (k - kp) * bpc;
-                k = kp;
-            }
+            {
+                profiling::scope walk_profile{profiling::phase::backward_walk};
+                auto k = n;
+                while (k != 0) {
+                    auto bpc = previous[k].first;
+                    auto &f = previous[k].second;
+                    mem_out.emplace_back(bpc, *f);
+                    auto kp = std::visit([](auto &&mo) -> x_t { return mo.get_start(); }, *f);
+                    residuals_bit_size += (k - kp) * bpc;
+                    k = kp;
+                }
 
-            std::reverse(mem_out.begin(), mem_out.end());
+                std::reverse(mem_out.begin(), mem_out.end());
+                memory::account(mem_out);
+            }
             //make_residuals(begin, end);
             simd_make_residuals(begin);
+            if (aggregates)
+                build_aggregates();
         }
 
+    public:
+
         template<typename It>
         inline void decompress(It out_begin, It out_end) const {
             auto n = std::distance(out_begin, out_end);
@@ -521,16 +873,18 @@ namespace pfa::neats {
                 auto imt = index_model_fun;
                 auto mt = (uint8_t) (model_types_0[imt]) | ((uint8_t) (model_types_1[imt]) << 1);
 
-                auto t1 = coefficients_t1[offset_coefficients];
-                auto t2 = coefficients_t2[offset_coefficients];
+                auto [_s, _t0, t1, t2] = coefficients_at(offset_coefficients, (typename poa_t::approx_fun_t) (mt),
+                                                         offset_coefficients_s, offset_coefficients_t0);
                 offset_coefficients++;
                 std::optional<x_t> s = std::nullopt;
                 std::optional<T1> t0 = std::nullopt;
 
                 if ((typename poa_t::approx_fun_t) (mt) == poa_t::approx_fun_t::Sqrt) { // Too arbitrary?
-                    s = coefficients_s[offset_coefficients_s++];
+                    s = _s;
+                    offset_coefficients_s++;
                 } else if ((typename poa_t::approx_fun_t) (mt) == poa_t::approx_fun_t::Quadratic) {
-                    t0 = coefficients_t0[offset_coefficients_t0++];
+                    t0 = _t0;
+                    offset_coefficients_t0++;
                 }
 
                 auto model = poa_t::piecewise_non_linear_approximation::make_fun((typename poa_t::approx_fun_t) (mt),
@@ -548,11 +902,12 @@ namespace pfa::neats {
 
                 start = end;
             }
+            apply_exceptions(0, n, out_begin);
         }
 
 
         template<typename T = int64_t, typename float_scalar_t = std::conditional_t<sizeof(T) == 4, float, double>>
-        inline void simd_approximations(float_scalar_t *out) { //, It in_begin, It in_end) {
+        inline void simd_approximations(float_scalar_t *out) const { //, It in_begin, It in_end) {
             namespace stdx = std::experimental;
 
             const auto approx_v = out;
@@ -597,12 +952,9 @@ namespace pfa::neats {
                 auto imt = index_model_fun;
                 auto mt = (uint8_t) (model_types_0[imt]) | ((uint8_t) (model_types_1[imt]) << 1);
 
-                auto t1 = coefficients_t1[offset_coefficients];
-                auto t2 = coefficients_t2[offset_coefficients];
+                auto [s, t0, t1, t2] = coefficients_at(offset_coefficients, static_cast<poa_t::approx_fun_t>(mt),
+                                                       offset_coefficients_s, offset_coefficients_t0);
                 offset_coefficients++;
-
-                auto t0 = coefficients_t0[offset_coefficients_t0];
-                auto s = coefficients_s[offset_coefficients_s];
                 auto t0v = floatv_simd_t{static_cast<float_scalar_t>(t0)};
                 auto sv = floatv_simd_t{static_cast<float_scalar_t>(s)};
 
@@ -720,36 +1072,12 @@ namespace pfa::neats {
             return bextr(word, bit_offset % 8, length);
         }
 
+        /** Adds the values of the function of a fragment of type mt at the positions st_off, ..., st_off + num - 1 of
+         * the fragment to out_start[0, num). The vectorized evaluators used by simd_decompress and simd_scan, also
+         * used by neats::lossy_compressor. */
         template<typename T>
-        inline void simd_decompress(T *out) {
-            auto unpack_residuals = [this](const auto im, x_t offset_res, const auto num_residuals, auto *out_start) {
-                constexpr auto _simd_width_bit_size = simd_width * sizeof(int_scalar_t) * 8; // 512 bits
-                const uint8_t bpc = bits_per_correction[im];
-                // NOTE: we are assuming bpc != 0
-                const int_scalar_t eps = BPC_TO_EPSILON(bpc) + 1;
-
-                auto j{0};
-                intv_simd_t simd_w{};
-                for (; j + simd_width <= num_residuals; j += simd_width) {
-                    for (std::size_t i{0}; i < simd_width; ++i) {
-                        const auto r = static_cast<int_scalar_t>(read_field(residuals.data(), offset_res, bpc));
-                        //const auto r = static_cast<int_scalar_t>(sdsl::bits::read_int(
-                        //        residuals.data() + (offset_res >> 6u), offset_res & 0x3F, bpc));
-                        simd_w[i] = r - eps;
-                        offset_res += bpc;
-                    }
-                    simd_w.copy_to(out_start + j, stdx::element_aligned);
-                }
-
-                while (j < num_residuals) {
-                    const auto r = static_cast<int_scalar_t>(read_field(residuals.data(), offset_res, bpc));
-                    //const auto r = sdsl::bits::read_int(residuals.data() + (offset_res >> 6u), offset_res & 0x3F, bpc);
-                    *(out_start + j) = r - eps;
-                    offset_res += bpc;
-                    ++j;
-                }
-            };
-
+        static inline void add_approximation(typename poa_t::approx_fun_t mt, x_t _s, T1 _t0, T1 _t1, T2 _t2,
+                                             x_t st_off, const size_t num, T *out_start) {
             auto apply_simd_linear = [](auto x, floatv_simd_t t1, floatv_simd_t t2) -> intv_simd_t {
                 return stdx::static_simd_cast<intv_simd_t>(stdx::ceil(x * t1 + t2));
             };
@@ -785,97 +1113,96 @@ namespace pfa::neats {
 
             const floatv_simd_t startv([](int i) { return i + 1; });
             const floatv_simd_t qstartv([](int i) { return i; });
-            auto unpack_poa = [&](poa_t::approx_fun_t mt, x_t offset_coeff_s, x_t offset_coeff_t0, x_t offset_coeff,
-                                  const auto num_residuals, auto *out_start) {
-
-                float_scalar_t t0, t1, t2, s;
-                floatv_simd_t t0v, t1v, t2v, sv;
-                intv_simd_t _residuals{};
-                switch (mt) {
-                    case poa_t::approx_fun_t::Linear : {
-                        t1 = coefficients_t1[offset_coeff];
-                        t2 = coefficients_t2[offset_coeff];
-                        t1v = floatv_simd_t{t1};
-                        t2v = floatv_simd_t{t2};
-
-                        auto j{0};
-                        for (; j + simd_width <= num_residuals; j += simd_width) {
-                            _residuals.copy_from(out_start + j, stdx::element_aligned);
-                            _residuals += apply_simd_linear(startv + j, t1v, t2v);
-                            _residuals.copy_to(out_start + j, stdx::element_aligned);
-                        }
-
-                        for (; j < num_residuals; ++j) {
-                            int_scalar_t _y = apply_linear(j + 1, t1, t2);
-                            *(out_start + j) += _y;
-                        }
-                        break;
+            const float_scalar_t t1 = _t1, t2 = _t2;
+            const floatv_simd_t t1v{t1}, t2v{t2};
+            intv_simd_t _residuals{};
+            x_t j{0};
+            switch (mt) {
+                case poa_t::approx_fun_t::Linear : {
+                    for (; j + simd_width <= num; j += simd_width) {
+                        _residuals.copy_from(out_start + j, stdx::element_aligned);
+                        _residuals += apply_simd_linear(startv + j + st_off, t1v, t2v);
+                        _residuals.copy_to(out_start + j, stdx::element_aligned);
                     }
-                    case poa_t::approx_fun_t::Quadratic : {
-                        t0 = coefficients_t0[offset_coeff_t0];
-                        t0v = floatv_simd_t{t0};
-                        t1 = coefficients_t1[offset_coeff];
-                        t2 = coefficients_t2[offset_coeff];
-                        t1v = floatv_simd_t{t1};
-                        t2v = floatv_simd_t{t2};
-
-                        auto j{0};
-                        for (; j + simd_width <= num_residuals; j += simd_width) {
-                            _residuals.copy_from(out_start + j, stdx::element_aligned);
-                            _residuals += apply_simd_quadratic(qstartv + j, t0v, t1v, t2v);
-                            _residuals.copy_to(out_start + j, stdx::element_aligned);
-                        }
-
-                        for (; j < num_residuals; ++j) {
-                            int_scalar_t _y = apply_quadratic(j, t0, t1, t2);
-                            *(out_start + j) += _y;
-                        }
-                        break;
+                    for (; j < num; ++j)
+                        *(out_start + j) += apply_linear(j + st_off + 1, t1, t2);
+                    break;
+                }
+                case poa_t::approx_fun_t::Quadratic : {
+                    const float_scalar_t t0 = _t0;
+                    const floatv_simd_t t0v{t0};
+                    for (; j + simd_width <= num; j += simd_width) {
+                        _residuals.copy_from(out_start + j, stdx::element_aligned);
+                        _residuals += apply_simd_quadratic(qstartv + j + st_off, t0v, t1v, t2v);
+                        _residuals.copy_to(out_start + j, stdx::element_aligned);
                     }
-                    case poa_t::approx_fun_t::Exponential : {
-
-                        t1 = coefficients_t1[offset_coeff];
-                        t2 = coefficients_t2[offset_coeff];
-                        t1v = floatv_simd_t{t1};
-                        t2v = floatv_simd_t{t2};
+                    for (; j < num; ++j)
+                        *(out_start + j) += apply_quadratic(j + st_off, t0, t1, t2);
+                    break;
+                }
+                case poa_t::approx_fun_t::Exponential : {
+                    for (; j + simd_width <= num; j += simd_width) {
+                        _residuals.copy_from(out_start + j, stdx::element_aligned);
+                        _residuals += apply_simd_exponential(startv + j + st_off, t1v, t2v);
+                        _residuals.copy_to(out_start + j, stdx::element_aligned);
+                    }
+                    for (; j < num; ++j)
+                        *(out_start + j) += apply_exponential(j + 1 + st_off, t1, t2);
+                    break;
+                }
+                case poa_t::approx_fun_t::Sqrt : {
+                    const auto s = static_cast<float_scalar_t>(_s);
+                    const floatv_simd_t sv{s};
+                    for (; j + simd_width <= num; j += simd_width) {
+                        _residuals.copy_from(out_start + j, stdx::element_aligned);
+                        _residuals += apply_simd_radical(startv + j + st_off, sv, t1v, t2v);
+                        _residuals.copy_to(out_start + j, stdx::element_aligned);
+                    }
+                    for (; j < num; ++j)
+                        *(out_start + j) += apply_radical(j + 1 + st_off, s, t1, t2);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
 
-                        auto j{0};
-                        for (; j + simd_width <= num_residuals; j += simd_width) {
-                            _residuals.copy_from(out_start + j, stdx::element_aligned);
-                            _residuals += apply_simd_exponential(startv + j, t1v, t2v);
-                            _residuals.copy_to(out_start + j, stdx::element_aligned);
-                        }
+        template<typename T>
+        inline void simd_decompress(T *out) const {
+            auto unpack_residuals = [this](const auto im, x_t offset_res, const auto num_residuals, auto *out_start) {
+                constexpr auto _simd_width_bit_size = simd_width * sizeof(int_scalar_t) * 8; // 512 bits
+                const uint8_t bpc = bits_per_correction[im];
+                // NOTE: we are assuming bpc != 0
+                const int_scalar_t eps = BPC_TO_EPSILON(bpc) + 1;
 
-                        for (; j < num_residuals; ++j) {
-                            int_scalar_t _y = apply_exponential(j + 1, t1, t2);
-                            *(out_start + j) += _y;
-                        }
-                        break;
+                auto j{0};
+                intv_simd_t simd_w{};
+                for (; j + simd_width <= num_residuals; j += simd_width) {
+                    for (std::size_t i{0}; i < simd_width; ++i) {
+                        const auto r = static_cast<int_scalar_t>(read_field(residuals.data(), offset_res, bpc));
+                        //const auto r = static_cast<int_scalar_t>(sdsl::bits::read_int(
+                        //        residuals.data() + (offset_res >> 6u), offset_res & 0x3F, bpc));
+                        simd_w[i] = r - eps;
+                        offset_res += bpc;
                     }
-                    case poa_t::approx_fun_t::Sqrt : {
-                        s = static_cast<float_scalar_t>(coefficients_s[offset_coeff_s]);
-                        t1 = coefficients_t1[offset_coeff];
-                        t2 = coefficients_t2[offset_coeff];
-                        t1v = floatv_simd_t{t1};
-                        t2v = floatv_simd_t{t2};
-                        sv = floatv_simd_t{s};
-
-                        auto j{0};
-                        for (; j + simd_width <= num_residuals; j += simd_width) {
-                            _residuals.copy_from(out_start + j, stdx::element_aligned);
-                            _residuals += apply_simd_radical(startv + j, sv, t1v, t2v);
-                            _residuals.copy_to(out_start + j, stdx::element_aligned);
-                        }
+                    simd_w.copy_to(out_start + j, stdx::element_aligned);
+                }
 
-                        for (; j < num_residuals; ++j) {
-                            int_scalar_t _y = apply_radical(j + 1, s, t1, t2);
-                            *(out_start + j) += _y;
-                        }
-                        break;
-                    }
+                while (j < num_residuals) {
+                    const auto r = static_cast<int_scalar_t>(read_field(residuals.data(), offset_res, bpc));
+                    //const auto r = sdsl::bits::read_int(residuals.data() + (offset_res >> 6u), offset_res & 0x3F, bpc);
+                    *(out_start + j) = r - eps;
+                    offset_res += bpc;
+                    ++j;
                 }
             };
 
+            auto unpack_poa = [&](poa_t::approx_fun_t mt, x_t offset_coeff_s, x_t offset_coeff_t0, x_t offset_coeff,
+                                  const auto num_residuals, auto *out_start) {
+                const auto [_s, _t0, _t1, _t2] = coefficients_at(offset_coeff, mt, offset_coeff_s, offset_coeff_t0);
+                add_approximation(mt, _s, _t0, _t1, _t2, 0, num_residuals, out_start);
+            };
+
             uint8_t bpc{};
             x_t offset_res{0};
             auto it_end = starting_positions_ef.at(0);
@@ -926,6 +1253,7 @@ namespace pfa::neats {
                 offset_res += bpc * (end - start);
                 start = end;
             }
+            apply_exceptions(0, _n, out);
         }
 
         template<typename T>
@@ -958,131 +1286,10 @@ namespace pfa::neats {
                 }
             };
 
-            auto apply_simd_linear = [](auto x, floatv_simd_t t1, floatv_simd_t t2) -> intv_simd_t {
-                return stdx::static_simd_cast<intv_simd_t>(stdx::ceil(x * t1 + t2));
-            };
-
-            auto apply_simd_quadratic = [](auto x, floatv_simd_t t0, floatv_simd_t t1,
-                                           floatv_simd_t t2) -> intv_simd_t {
-                return stdx::static_simd_cast<intv_simd_t>(stdx::ceil(t0 * x * x + t1 * x + t2));
-            };
-
-            auto apply_simd_radical = [](auto x, auto s, floatv_simd_t t1, floatv_simd_t t2) -> intv_simd_t {
-                return stdx::static_simd_cast<intv_simd_t>(stdx::round(t1 * stdx::sqrt(x + s) + t2));
-            };
-
-            auto apply_simd_exponential = [](auto x, floatv_simd_t t1, floatv_simd_t t2) -> intv_simd_t {
-                return stdx::static_simd_cast<intv_simd_t>(stdx::round(t2 * stdx::exp(t1 * x)));
-            };
-
-            auto apply_linear = [](auto x, float_scalar_t t1, float_scalar_t t2) -> int_scalar_t {
-                return static_cast<int_scalar_t>(std::ceil(x * t1 + t2));
-            };
-
-            auto apply_quadratic = [](auto x, float_scalar_t t0, float_scalar_t t1, float_scalar_t t2) -> int_scalar_t {
-                return static_cast<int_scalar_t>(std::ceil(t0 * x * x + t1 * x + t2));
-            };
-
-            auto apply_radical = [](auto x, auto s, float_scalar_t t1, float_scalar_t t2) -> int_scalar_t {
-                return static_cast<int_scalar_t>(std::round(t1 * std::sqrt(x + s) + t2));
-            };
-
-            auto apply_exponential = [](auto x, float_scalar_t t1, float_scalar_t t2) -> int_scalar_t {
-                return static_cast<int_scalar_t>(std::round(t2 * std::exp(t1 * x)));
-            };
-
-            const floatv_simd_t startv([](int i) { return i + 1; });
-            const floatv_simd_t qstartv([](int i) { return i; });
             auto unpack_poa = [&](poa_t::approx_fun_t mt, x_t offset_coeff_s, x_t offset_coeff_t0, x_t offset_coeff,
                                   x_t st_off, const auto num_residuals, auto *out_start) {
-
-                float_scalar_t t0, t1, t2, s;
-                floatv_simd_t t0v, t1v, t2v, sv;
-                intv_simd_t _residuals{};
-                switch (mt) {
-                    case poa_t::approx_fun_t::Linear : {
-                        t1 = coefficients_t1[offset_coeff];
-                        t2 = coefficients_t2[offset_coeff];
-                        t1v = floatv_simd_t{t1};
-                        t2v = floatv_simd_t{t2};
-
-                        auto j{0};
-                        for (; j + simd_width <= num_residuals; j += simd_width) {
-                            _residuals.copy_from(out_start + j, stdx::element_aligned);
-                            _residuals += apply_simd_linear(startv + j + st_off, t1v, t2v);
-                            _residuals.copy_to(out_start + j, stdx::element_aligned);
-                        }
-
-                        for (; j < num_residuals; ++j) {
-                            int_scalar_t _y = apply_linear(j + st_off + 1, t1, t2);
-                            *(out_start + j) += _y;
-                        }
-                        break;
-                    }
-
-                    case poa_t::approx_fun_t::Quadratic : {
-                        t0 = coefficients_t0[offset_coeff_t0];
-                        t0v = floatv_simd_t{t0};
-                        t1 = coefficients_t1[offset_coeff];
-                        t2 = coefficients_t2[offset_coeff];
-                        t1v = floatv_simd_t{t1};
-                        t2v = floatv_simd_t{t2};
-
-                        auto j{0};
-                        for (; j + simd_width <= num_residuals; j += simd_width) {
-                            _residuals.copy_from(out_start + j, stdx::element_aligned);
-                            _residuals += apply_simd_quadratic(qstartv + j + st_off, t0v, t1v, t2v);
-                            _residuals.copy_to(out_start + j, stdx::element_aligned);
-                        }
-
-                        for (; j < num_residuals; ++j) {
-                            int_scalar_t _y = apply_quadratic(j + st_off, t0, t1, t2);
-                            *(out_start + j) += _y;
-                        }
-                        break;
-                    }
-                    case poa_t::approx_fun_t::Exponential : {
-
-                        t1 = coefficients_t1[offset_coeff];
-                        t2 = coefficients_t2[offset_coeff];
-                        t1v = floatv_simd_t{t1};
-                        t2v = floatv_simd_t{t2};
-
-                        auto j{0};
-                        for (; j + simd_width <= num_residuals; j += simd_width) {
-                            _residuals.copy_from(out_start + j, stdx::element_aligned);
-                            _residuals += apply_simd_exponential(startv + j + st_off, t1v, t2v);
-                            _residuals.copy_to(out_start + j, stdx::element_aligned);
-                        }
-
-                        for (; j < num_residuals; ++j) {
-                            int_scalar_t _y = apply_exponential(j + 1 + st_off, t1, t2);
-                            *(out_start + j) += _y;
-                        }
-                        break;
-                    }
-                    case poa_t::approx_fun_t::Sqrt : {
-                        s = static_cast<float_scalar_t>(coefficients_s[offset_coeff_s]);
-                        t1 = coefficients_t1[offset_coeff];
-                        t2 = coefficients_t2[offset_coeff];
-                        t1v = floatv_simd_t{t1};
-                        t2v = floatv_simd_t{t2};
-                        sv = floatv_simd_t{s};
-
-                        auto j{0};
-                        for (; j + simd_width <= num_residuals; j += simd_width) {
-                            _residuals.copy_from(out_start + j, stdx::element_aligned);
-                            _residuals += apply_simd_radical(startv + j + st_off, sv, t1v, t2v);
-                            _residuals.copy_to(out_start + j, stdx::element_aligned);
-                        }
-
-                        for (; j < num_residuals; ++j) {
-                            int_scalar_t _y = apply_radical(j + 1 + st_off, s, t1, t2);
-                            *(out_start + j) += _y;
-                        }
-                        break;
-                    }
-                }
+                const auto [_s, _t0, _t1, _t2] = coefficients_at(offset_coeff, mt, offset_coeff_s, offset_coeff_t0);
+                add_approximation(mt, _s, _t0, _t1, _t2, st_off, num_residuals, out_start);
             };
 
             auto pre = starting_positions_ef.predecessor(s);
@@ -1144,6 +1351,7 @@ namespace pfa::neats {
                 st_off = 0;
                 offset_coefficients++;
             }
+            apply_exceptions(s, e, out);
         }
 
 
@@ -1265,36 +1473,89 @@ namespace pfa::neats {
 
 
         size_t size_in_bits() const {
-            return sizeof(*this) * 8 + residuals.bit_size() +  // offset_residuals.size() * sizeof(uint32_t) * 8 +
+            return sizeof(*this) * 8 + residuals.bit_size() + exceptions_size_in_bits() +  // offset_residuals.size() * sizeof(uint32_t) * 8 +
                    //sdsl::size_in_bytes(offset_residuals_ef) * 8 +
                    starting_positions_ef.size_in_bytes() * 8 +
-                   sizeof(x_t) * 8 * coefficients_s.size() + sizeof(T1) * 8 * coefficients_t0.size() +
-                   sizeof(T1) * 8 * coefficients_t1.size() + sizeof(T2) * 8 * coefficients_t2.size() +
+                   coefficients_size_in_bits() +
                    model_types_0.bit_size() + model_types_1.bit_size() + qbv.bit_size() +
                    offset_residuals_ef.size_in_bytes() * 8 + starting_positions_ef.size_in_bytes() * 8 +
                    //(sdsl::size_in_bytes(offset_residuals_ef_sls) + sdsl::size_in_bytes(starting_positions_select) +
                    // sdsl::size_in_bytes(starting_positions_rank) +
                    (sdsl::size_in_bytes(fun_1_rank) + sdsl::size_in_bytes(quad_fun_rank)) * 8 +
                    //sdsl::size_in_bytes(starting_positions_ef) * 8 +
-                   bits_per_correction.bit_size();
+                   bits_per_correction.bit_size() + aggregates_size_in_bits();
         }
 
         size_t storage_size_in_bits() const {
             auto num_partitions = bits_per_correction.size();
-            return residuals.bit_size() + sizeof(x_t) * 8 * coefficients_s.size() +
-                   sizeof(T1) * 8 * coefficients_t0.size() +
-                   sizeof(T1) * 8 * coefficients_t1.size() + sizeof(T2) * 8 * coefficients_t2.size() +
+            return residuals.bit_size() + exceptions_size_in_bits() + coefficients_size_in_bits() +
                    model_types_0.bit_size() + model_types_1.bit_size() + (num_partitions * sizeof(x_t) * 8) +
-                   bits_per_correction.bit_size();
+                   bits_per_correction.bit_size() + aggregates_size_in_bits();
+        }
+
+        size_t aggregates_size_in_bits() const {
+            if (!aggregates)
+                return 0;
+            size_t bits = fragment_sums.bit_size() + fragment_min.bit_size() + fragment_max.bit_size();
+            for (const auto &level: block_min)
+                bits += level.bit_size();
+            for (const auto &level: block_max)
+                bits += level.bit_size();
+            return bits;
         }
 
         size_t coefficients_size_in_bits() const {
             return sizeof(x_t) * 8 * coefficients_s.size() + sizeof(T1) * 8 * coefficients_t0.size() +
-                   sizeof(T1) * 8 * coefficients_t1.size() + sizeof(T2) * 8 * coefficients_t2.size();
+                   sizeof(T1) * 8 * coefficients_t1.size() + sizeof(T2) * 8 * coefficients_t2.size() +
+                   coefficients_packed.size_in_bits();
         }
 
         size_t residuals_size_in_bits() const {
-            return residuals.bit_size();
+            return residuals.bit_size() + exceptions_size_in_bits();
+        }
+
+        size_t exceptions_size_in_bits() const {
+            if (!patched)
+                return 0;
+            return patched_fragments.bit_size() + exception_positions.size_in_bytes() * 8 +
+                   exception_values.bit_size();
+        }
+
+        /** Returns the statistics of the fragments and of the space (see compressor_stats), from the metadata only. */
+        [[nodiscard]] compressor_stats stats() const {
+            compressor_stats st;
+            st.n = _n;
+            st.total_bits = size_in_bits();
+            st.residual_bits = residuals.bit_size();
+            st.exception_bits = exceptions_size_in_bits();
+            st.coefficient_bits = coefficients_size_in_bits();
+            st.aggregate_bits = aggregates_size_in_bits();
+            if (patched) {
+                st.num_exceptions = exception_values.size();
+                st.patched_fragments = sdsl::util::cnt_one_bits(patched_fragments);
+            }
+            if (_n == 0)
+                return st;
+
+            st.min_length = std::numeric_limits<size_t>::max();
+            for_each_fragment(0, _n, [&](const fragment_view &f) {
+                const size_t t = std::to_underlying(f.type);
+                const size_t len = f.end - f.start;
+                ++st.num_fragments;
+                ++st.fragments_per_type[t];
+                ++st.fragments_per_bpc[f.bpc];
+                ++st.fragments_per_type_bpc[t][f.bpc];
+                st.min_length = std::min(st.min_length, len);
+                st.max_length = std::max(st.max_length, len);
+                ++st.length_histogram[std::bit_width(len) - 1];
+                st.values_per_type[t] += len;
+                st.residual_bits_per_type[t] += len * f.bpc;
+                if (f.bpc == 0) {
+                    ++st.zero_bpc_fragments;
+                    st.zero_bpc_values += len;
+                }
+            });
+            return st;
         }
 
         void size_info(bool header = true) const {
@@ -1305,8 +1566,7 @@ namespace pfa::neats {
             std::cout << residuals.bit_size() << ",";
             //std::cout << offset_residuals.size() * sizeof(uint32_t) * 8 << ",";
             std::cout << offset_residuals_ef.size_in_bytes() * 8 << ",";
-            std::cout << sizeof(x_t) * 8 * coefficients_s.size() + sizeof(T1) * 8 * coefficients_t0.size() +
-                         sizeof(T1) * 8 * coefficients_t1.size() + sizeof(T2) * 8 * coefficients_t2.size() << ",";
+            std::cout << coefficients_size_in_bits() << ",";
             std::cout << model_types_0.bit_size() + model_types_1.bit_size() + qbv.bit_size() << ",";
             //std::cout << (sdsl::size_in_bytes(offset_residuals_ef_sls) +
             //             sdsl::size_in_bytes(starting_positions_select) +
@@ -1320,8 +1580,7 @@ namespace pfa::neats {
         void storage_size_info() const {
             auto num_partitions = model_types_0.size();
             std::cout << residuals.bit_size() << ","
-                      << sizeof(x_t) * 8 * coefficients_s.size() + sizeof(T1) * 8 * coefficients_t0.size() +
-                         sizeof(T1) * 8 * coefficients_t1.size() + sizeof(T2) * 8 * coefficients_t2.size() << ","
+                      << coefficients_size_in_bits() << ","
                       << model_types_0.bit_size() + model_types_1.bit_size() << ","
                       << num_partitions * sizeof(x_t) * 8 << ","
                       << bits_per_correction.bit_size() << ",";
@@ -1342,20 +1601,24 @@ namespace pfa::neats {
             //        index_model == 0 ? 0 : offset_residuals_ef_sls(index_model);//offset_residuals_ef[index_model - 1];
             auto offset_residual = index_model == 0 ? 0 : offset_residuals_ef[index_model - 1];
 
-            auto t1 = coefficients_t1[index_model];
-            auto t2 = coefficients_t2[index_model];
-
             std::optional<x_t> s = std::nullopt;
             std::optional<T1> t0 = std::nullopt;
+            T1 t1;
+            T2 t2;
 
             if ((typename poa_t::approx_fun_t) (type_model) == poa_t::approx_fun_t::Quadratic) {
                 //auto idx_coefficient_t0 = quad_fun_rank(imt + 1) - 1;
                 auto idx_coefficient_t0 = quad_fun_rank(imt);
-                t0 = coefficients_t0[idx_coefficient_t0];
+                std::tie(std::ignore, t0, t1, t2) = coefficients_at(index_model, poa_t::approx_fun_t::Quadratic, 0,
+                                                                    idx_coefficient_t0);
             } else if ((typename poa_t::approx_fun_t) (type_model) == poa_t::approx_fun_t::Sqrt) {
                 //auto idx_coefficient_s = (fun_1_rank(imt + 1) - quad_fun_rank(imt + 1)) - 1;
                 auto idx_coefficient_s = fun_1_rank(imt) - quad_fun_rank(imt);
-                s = coefficients_s[idx_coefficient_s];
+                std::tie(s, std::ignore, t1, t2) = coefficients_at(index_model, poa_t::approx_fun_t::Sqrt,
+                                                                   idx_coefficient_s, 0);
+            } else {
+                std::tie(std::ignore, std::ignore, t1, t2) = coefficients_at(
+                        index_model, (typename poa_t::approx_fun_t) (type_model), 0, 0);
             }
 
             auto model = poa_t::piecewise_non_linear_approximation::make_fun(
@@ -1368,10 +1631,487 @@ namespace pfa::neats {
             auto _y = std::visit([&](auto &&mo) { return mo(i + 1); }, model);
             //y_t residual = read_field(residuals.data(), offset_residual + bpc * (i - start_pos), bpc);
             auto y = _y + residual;
+            if (patched && patched_fragments[index_model])
+                y += exception_at(i);
             return y;
         }
 
 
+        /** Stores the sum, the minimum and the maximum of the values of every fragment, so that range_sum, range_min
+         * and range_max decode only the (at most two) fragments that the range covers partially. It costs 64 bits per
+         * fragment for the sums plus two bit-compressed words for the minimum and the maximum, and sparse tables over
+         * blocks of 64 fragments (about log(l / 64) / 64 words per fragment), with which range_min and range_max read
+         * O(1) blocks and at most 2 * 64 fragment extrema. */
+        void build_aggregates() {
+            profiling::scope profile{profiling::phase::aggregates};
+            const auto l = bits_per_correction.size();
+            memory::vector<y_t> values(_n);
+            if (_n > 0)
+                simd_scan(0, _n, values.data());
+
+            aggregates_base = _n > 0 ? *std::min_element(values.begin(), values.end()) : y_t{0};
+            fragment_sums = sdsl::int_vector<64>(l + 1, 0);
+            fragment_min = sdsl::int_vector<>(l, 0, 64);
+            fragment_max = sdsl::int_vector<>(l, 0, 64);
+            memory::account(fragment_sums, fragment_min, fragment_max);
+            uint64_t sum = 0;
+            for (size_t im = 0; im < l; ++im) {
+                const x_t start = starting_positions_ef[im];
+                const x_t end = im + 1 < l ? x_t(starting_positions_ef[im + 1]) : _n;
+                const auto [mn, mx] = std::minmax_element(values.begin() + start, values.begin() + end);
+                for (auto j = start; j < end; ++j)
+                    sum += static_cast<uint64_t>(values[j]);
+                fragment_sums[im + 1] = sum;
+                fragment_min[im] = static_cast<uint64_t>(*mn - aggregates_base);
+                fragment_max[im] = static_cast<uint64_t>(*mx - aggregates_base);
+            }
+            memory::bit_compress(fragment_min);
+            memory::bit_compress(fragment_max);
+            build_block_extrema();
+            aggregates = true;
+        }
+
+        [[nodiscard]] bool has_aggregates() const {
+            return aggregates;
+        }
+
+        /** Returns the sum of the values in [from, to), exact as long as it fits an int64_t. */
+        int64_t range_sum(x_t from, x_t to) const {
+            uint64_t sum = 0;
+            reduce(from, to, [&](const y_t *v, x_t num) {
+                for (x_t j = 0; j < num; ++j)
+                    sum += static_cast<uint64_t>(v[j]);
+            }, [&](size_t a, size_t b) {
+                sum += fragment_sums[b] - fragment_sums[a];
+            });
+            return static_cast<int64_t>(sum);
+        }
+
+        double range_mean(x_t from, x_t to) const {
+            if (from >= to)
+                throw std::out_of_range("empty range");
+            return static_cast<double>(range_sum(from, to)) / (to - from);
+        }
+
+        y_t range_min(x_t from, x_t to) const {
+            if (from >= to)
+                throw std::out_of_range("empty range");
+            auto res = std::numeric_limits<y_t>::max();
+            reduce(from, to, [&](const y_t *v, x_t num) {
+                res = std::min(res, *std::min_element(v, v + num));
+            }, [&](size_t a, size_t b) {
+                res = std::min(res, static_cast<y_t>(aggregates_base + fragment_extremum<false>(a, b)));
+            });
+            return res;
+        }
+
+        y_t range_max(x_t from, x_t to) const {
+            if (from >= to)
+                throw std::out_of_range("empty range");
+            auto res = std::numeric_limits<y_t>::min();
+            reduce(from, to, [&](const y_t *v, x_t num) {
+                res = std::max(res, *std::max_element(v, v + num));
+            }, [&](size_t a, size_t b) {
+                res = std::max(res, static_cast<y_t>(aggregates_base + fragment_extremum<true>(a, b)));
+            });
+            return res;
+        }
+
+
+        [[nodiscard]] size_t num_partitions() const {
+            return bits_per_correction.size();
+        }
+
+        /** The packed residuals, see fragment_view. */
+        [[nodiscard]] const uint64_t *residuals_data() const {
+            return residuals.data();
+        }
+
+        /** Calls visitor(const fragment_view &) on every fragment that overlaps [from, to), in order, without
+         * allocating. If the visitor returns a bool, the visit stops at the first false. */
+        template<typename Visitor>
+        void for_each_fragment(x_t from, x_t to, Visitor &&visitor) const {
+            if (from > to || to > _n)
+                throw std::out_of_range("range out of bounds");
+            if (from == to)
+                return;
+
+            const auto l = num_partitions();
+            auto it = starting_positions_ef.predecessor(from);
+            auto im = it.index();
+            x_t start = *it;
+            auto i_t0 = quad_fun_rank(im);
+            auto i_s = fun_1_rank(im) - i_t0;
+            uint64_t offset_res = im == 0 ? 0 : offset_residuals_ef[im - 1];
+            for (; im < l && start < to; ++im) {
+                const x_t end = im + 1 < l ? x_t(*(++it)) : _n;
+                const auto mt = static_cast<approx_fun_t>(model_types_0[im] | (model_types_1[im] << 1));
+                const uint8_t bpc = bits_per_correction[im];
+                const auto [_s, _t0, _t1, _t2] = coefficients_at(im, mt, i_s, i_t0);
+                const fragment_view f{im, start, end, mt, bpc, _s, _t0, _t1, _t2, offset_res,
+                                      bpc == 0 ? y_t{0} : static_cast<y_t>(BPC_TO_EPSILON(bpc) + 1),
+                                      patched && patched_fragments[im]};
+                if constexpr (std::is_same_v<std::invoke_result_t<Visitor &, const fragment_view &>, bool>) {
+                    if (!visitor(f))
+                        return;
+                } else {
+                    visitor(f);
+                }
+
+                i_s += mt == approx_fun_t::Sqrt;
+                i_t0 += mt == approx_fun_t::Quadratic;
+                offset_res += uint64_t(bpc) * (end - start);
+                start = end;
+            }
+        }
+
+        /** A random access iterator over the decoded values. It caches the function and the residual cursor of the
+         * fragment of the current position, so moving within a fragment costs no search and crossing into the next
+         * fragment reads one starting position; other jumps search the fragment with a predecessor query. It
+         * dereferences to a value (not a reference), and stays valid as long as the compressor is not moved. */
+        class const_iterator {
+            const compressor *c = nullptr;
+            x_t i = 0;
+            size_t im = 0;
+            x_t start = 0;
+            x_t end = 0; // [start, end) is the cached fragment, empty past the last value
+            out_t fun{};
+            uint64_t offset_res = 0;
+            y_t bias = 0;
+            uint8_t bpc = 0;
+            bool has_exceptions = false;
+
+            void load(size_t k, x_t s) {
+                im = k;
+                start = s;
+                end = k + 1 < c->num_partitions() ? x_t(c->starting_positions_ef[k + 1]) : c->_n;
+                fun = c->fragment_at(k, s);
+                offset_res = k == 0 ? 0 : c->offset_residuals_ef[k - 1];
+                bpc = c->bits_per_correction[k];
+                bias = bpc == 0 ? y_t{0} : static_cast<y_t>(BPC_TO_EPSILON(bpc) + 1);
+                has_exceptions = c->patched && c->patched_fragments[k];
+            }
+
+            void seek() {
+                if (i >= c->_n) {
+                    start = end = i;
+                    return;
+                }
+                auto it = c->starting_positions_ef.predecessor(i);
+                load(it.index(), static_cast<x_t>(*it));
+            }
+
+        public:
+            using iterator_concept = std::random_access_iterator_tag;
+            using iterator_category = std::input_iterator_tag;
+            using value_type = y_t;
+            using difference_type = std::ptrdiff_t;
+            using reference = y_t;
+            using pointer = void;
+
+            const_iterator() = default;
+
+            const_iterator(const compressor *c, x_t i) : c{c}, i{i} {
+                seek();
+            }
+
+            [[nodiscard]] x_t position() const {
+                return i;
+            }
+
+            y_t operator*() const {
+                auto y = std::visit([&](auto &&mo) -> y_t { return mo(i + 1); }, fun);
+                if (bpc != 0)
+                    y += static_cast<y_t>(c->read_field(c->residuals.data(), offset_res + bpc * uint64_t(i - start),
+                                                        bpc)) - bias;
+                if (has_exceptions)
+                    y += c->exception_at(i);
+                return y;
+            }
+
+            y_t operator[](difference_type n) const {
+                return *(*this + n);
+            }
+
+            const_iterator &operator++() {
+                if (++i == end) {
+                    if (i < c->_n)
+                        load(im + 1, i);
+                    else
+                        start = end = i;
+                }
+                return *this;
+            }
+
+            const_iterator operator++(int) {
+                auto tmp = *this;
+                ++*this;
+                return tmp;
+            }
+
+            const_iterator &operator--() {
+                if (i-- == start)
+                    seek();
+                return *this;
+            }
+
+            const_iterator operator--(int) {
+                auto tmp = *this;
+                --*this;
+                return tmp;
+            }
+
+            const_iterator &operator+=(difference_type n) {
+                i += n;
+                if (i < start || i >= end)
+                    seek();
+                return *this;
+            }
+
+            const_iterator &operator-=(difference_type n) {
+                return *this += -n;
+            }
+
+            friend const_iterator operator+(const_iterator it, difference_type n) {
+                return it += n;
+            }
+
+            friend const_iterator operator+(difference_type n, const_iterator it) {
+                return it += n;
+            }
+
+            friend const_iterator operator-(const_iterator it, difference_type n) {
+                return it -= n;
+            }
+
+            friend difference_type operator-(const const_iterator &a, const const_iterator &b) {
+                return static_cast<difference_type>(a.i) - static_cast<difference_type>(b.i);
+            }
+
+            friend bool operator==(const const_iterator &a, const const_iterator &b) {
+                return a.i == b.i;
+            }
+
+            friend std::strong_ordering operator<=>(const const_iterator &a, const const_iterator &b) {
+                return a.i <=> b.i;
+            }
+        };
+
+        const_iterator begin() const {
+            return {this, 0};
+        }
+
+        const_iterator end() const {
+            return {this, _n};
+        }
+
+        const_iterator cbegin() const {
+            return begin();
+        }
+
+        const_iterator cend() const {
+            return end();
+        }
+
+        /** Returns an iterator to the position i. */
+        const_iterator iterator_at(x_t i) const {
+            return {this, i};
+        }
+
+        /** Returns the function of the fragment im, which starts at start_pos. */
+        inline auto fragment_at(size_t im, x_t start_pos) const {
+            const auto mt = static_cast<typename poa_t::approx_fun_t>(model_types_0[im] | (model_types_1[im] << 1));
+            const auto [s, t0, t1, t2] = coefficients_at(im, mt, fun_1_rank(im) - quad_fun_rank(im), quad_fun_rank(im));
+            return poa_t::piecewise_non_linear_approximation::make_fun(
+                    mt, start_pos, mt == poa_t::approx_fun_t::Sqrt ? std::optional<x_t>{s} : std::nullopt,
+                    mt == poa_t::approx_fun_t::Quadratic ? std::optional<T1>{t0} : std::nullopt, t1, t2);
+        }
+
+        /** Returns e such that every value of the fragment im differs from its function by at most e. */
+        [[nodiscard]] y_t fragment_error_bound(size_t im) const {
+            const uint8_t bpc = bits_per_correction[im];
+            return bpc == 0 ? y_t{0} : static_cast<y_t>(BPC_TO_EPSILON(bpc) + 1);
+        }
+
+        /** Returns the value at position i approximated by its fragment function alone, without reading the
+         * residuals, and the bound e of |value - approximation|. An exception of a patched compressor stores the
+         * whole difference from the function, so its value is exact and its bound is 0. */
+        std::pair<y_t, y_t> approx_at(x_t i) const {
+            auto it = starting_positions_ef.predecessor(i);
+            const auto im = it.index();
+            auto y = std::visit([&](auto &&mo) -> y_t { return mo(i + 1); }, fragment_at(im, static_cast<x_t>(*it)));
+            if (patched && patched_fragments[im]) {
+                if (const auto exc = exception_at(i); exc != 0)
+                    return {y + exc, 0};
+            }
+            return {y, fragment_error_bound(im)};
+        }
+
+        /** Writes to out the values in [from, to) approximated by their fragment functions, like approx_at, and, if
+         * bounds is not null, the error bound of each value. Only the coefficients are read, never the residuals
+         * (the exceptions of a patched compressor are still applied: they are exact, with a bound of 0). */
+        template<typename T, typename E = y_t>
+        void approx_scan(x_t from, x_t to, T *out, E *bounds = nullptr) const {
+            if (from > to || to > _n)
+                throw std::out_of_range("range out of bounds");
+            if (from == to)
+                return;
+            std::fill(out, out + (to - from), T{0});
+
+            for_each_fragment(from, to, [&](const fragment_view &f) {
+                const auto s = std::max(f.start, from);
+                const auto e = std::min(f.end, to);
+                add_approximation(f.type, f.s, f.t0, f.t1, f.t2, s - f.start, e - s, out + (s - from));
+                if (bounds != nullptr)
+                    std::fill(bounds + (s - from), bounds + (e - from), static_cast<E>(f.residual_bias));
+                if (f.has_exceptions) {
+                    auto eit = exception_positions.predecessor(s);
+                    for (auto r = eit.index() + 1; r < exception_positions.size(); ++r) {
+                        const auto pos = *(++eit) - 1;
+                        if (pos >= e)
+                            break;
+                        out[pos - from] += exception_at(pos);
+                        if (bounds != nullptr)
+                            bounds[pos - from] = E{0};
+                    }
+                }
+            });
+        }
+
+        /** Writes to out the values at positions from, from + stride, ... (< to). Only the residual fields of those
+         * positions are read and every fragment function is evaluated only at them. */
+        template<typename T>
+        void scan_strided(x_t from, x_t to, x_t stride, T *out) const {
+            if (from > to || to > _n)
+                throw std::out_of_range("range out of bounds");
+            if (stride == 0)
+                throw std::runtime_error("stride must be positive");
+            if (from == to)
+                return;
+
+            const auto l = bits_per_correction.size();
+            uint64_t j = from;
+            while (j < to) {
+                // the fragments that the stride jumps over are never visited
+                auto it = starting_positions_ef.predecessor(j);
+                const auto im = it.index();
+                const x_t start = *it;
+                const x_t end = im + 1 < l ? x_t(starting_positions_ef[im + 1]) : _n;
+                const uint8_t bpc = bits_per_correction[im];
+                const auto eps = bpc == 0 ? y_t{0} : static_cast<y_t>(BPC_TO_EPSILON(bpc) + 1);
+                const uint64_t offset_res = im == 0 ? 0 : offset_residuals_ef[im - 1];
+                const bool has_exceptions = patched && patched_fragments[im];
+                const uint64_t e = std::min(end, to);
+                std::visit([&](auto &&mo) {
+                    for (; j < e; j += stride) {
+                        auto y = static_cast<y_t>(mo(j + 1));
+                        if (bpc != 0)
+                            y += static_cast<y_t>(read_field(residuals.data(), offset_res + bpc * (j - start), bpc)) - eps;
+                        if (has_exceptions)
+                            y += exception_at(j);
+                        *out++ = static_cast<T>(y);
+                    }
+                }, fragment_at(im, start));
+            }
+        }
+
+        /** Splits [from, to) into min(buckets, to - from) buckets of (almost) equal size and writes the aggregate of
+         * each of them to out. Returns the number of buckets written. Every bucket is reduced as in range_sum,
+         * range_min and range_max, so with the aggregates a bucket decodes at most its two boundary fragments. */
+        template<typename T>
+        size_t scan_bucketed(x_t from, x_t to, size_t buckets, bucket_aggregate agg, T *out) const {
+            if (from > to || to > _n)
+                throw std::out_of_range("range out of bounds");
+            const uint64_t len = to - from;
+            buckets = std::min<uint64_t>(buckets, len);
+            for (size_t k = 0; k < buckets; ++k) {
+                const x_t s = from + len * k / buckets;
+                const x_t e = from + len * (k + 1) / buckets;
+                switch (agg) {
+                    case bucket_aggregate::sum:
+                        out[k] = static_cast<T>(range_sum(s, e));
+                        break;
+                    case bucket_aggregate::min:
+                        out[k] = static_cast<T>(range_min(s, e));
+                        break;
+                    case bucket_aggregate::max:
+                        out[k] = static_cast<T>(range_max(s, e));
+                        break;
+                    case bucket_aggregate::mean:
+                        out[k] = static_cast<T>(range_mean(s, e));
+                        break;
+                }
+            }
+            return buckets;
+        }
+
+        /** Returns the smallest and the largest value of the fragment im (the zone map built by build_aggregates). */
+        [[nodiscard]] std::pair<y_t, y_t> fragment_bounds(size_t im) const {
+            if (!aggregates)
+                throw std::runtime_error("aggregates not built");
+            return {static_cast<y_t>(aggregates_base + fragment_min[im]),
+                    static_cast<y_t>(aggregates_base + fragment_max[im])};
+        }
+
+        /** Returns the first position in [from, to) whose value is greater than threshold, or to if there is none.
+         * With the aggregates, fragments whose maximum is not greater than threshold are skipped without decoding. */
+        x_t find_if_greater(y_t threshold, x_t from, x_t to) const {
+            x_t res = to;
+            const intv_simd_t thresholdv{threshold};
+            scan_candidates(from, to, [&](size_t im, x_t, x_t) {
+                return fragment_bounds(im).second > threshold;
+            }, [&](x_t s, const y_t *values, x_t num) {
+                x_t j = 0;
+                for (; j + simd_width <= num; j += simd_width) {
+                    const intv_simd_t v{values + j, stdx::element_aligned};
+                    const auto mask = v > thresholdv;
+                    if (stdx::any_of(mask)) {
+                        res = s + j + stdx::find_first_set(mask);
+                        return false;
+                    }
+                }
+                for (; j < num; ++j) {
+                    if (values[j] > threshold) {
+                        res = s + j;
+                        return false;
+                    }
+                }
+                return true;
+            });
+            return res;
+        }
+
+        /** Appends to out the positions in [from, to) whose value is in [lo, hi]. With the aggregates, fragments
+         * whose values are all outside [lo, hi] are skipped and those whose values are all inside are reported
+         * without decoding. */
+        template<typename It>
+        It filter_range(y_t lo, y_t hi, x_t from, x_t to, It out) const {
+            scan_candidates(from, to, [&](size_t im, x_t s, x_t e) {
+                const auto [mn, mx] = fragment_bounds(im);
+                if (mx < lo || mn > hi)
+                    return false;
+                if (lo <= mn && mx <= hi) {
+                    for (auto j = s; j < e; ++j)
+                        *out++ = j;
+                    return false;
+                }
+                return true;
+            }, [&](x_t s, const y_t *values, x_t num) {
+                for (x_t j = 0; j < num; ++j) {
+                    if (lo <= values[j] && values[j] <= hi)
+                        *out++ = s + j;
+                }
+                return true;
+            });
+            return out;
+        }
+
+        std::vector<x_t> filter_range(y_t lo, y_t hi) const {
+            std::vector<x_t> res;
+            filter_range(lo, hi, 0, _n, std::back_inserter(res));
+            return res;
+        }
+
         /*
         template<typename It>
         inline void print_info(It in_begin, It in_end, It out_begin, It out_end) const {
@@ -1478,6 +2218,25 @@ namespace pfa::neats {
             written_bytes += sdsl::serialize_vector(coefficients_t1, os, child, "coefficients_t1");
             written_bytes += sdsl::serialize_vector(coefficients_t2, os, child, "coefficients_t2");
 
+            written_bytes += sdsl::write_member(quantized, os, child, "quantized");
+            if (quantized)
+                written_bytes += coefficients_packed.serialize(os, child, "coefficients_packed");
+
+            written_bytes += sdsl::write_member(patched, os, child, "patched");
+            if (patched) {
+                written_bytes += sdsl::serialize(patched_fragments, os, child, "patched_fragments");
+                written_bytes += exception_positions.serialize(os, child, "exception_positions");
+                written_bytes += sdsl::serialize(exception_values, os, child, "exception_values");
+            }
+
+            written_bytes += sdsl::write_member(aggregates, os, child, "aggregates");
+            if (aggregates) {
+                written_bytes += sdsl::write_member(aggregates_base, os, child, "aggregates_base");
+                written_bytes += sdsl::serialize(fragment_sums, os, child, "fragment_sums");
+                written_bytes += sdsl::serialize(fragment_min, os, child, "fragment_min");
+                written_bytes += sdsl::serialize(fragment_max, os, child, "fragment_max");
+            }
+
             sdsl::structure_tree::add_size(child, written_bytes);
             return written_bytes;
         }
@@ -1523,7 +2282,7 @@ namespace pfa::neats {
         }
         */
 
-        void inline write_info_csv(std::ostream &ostream) {
+        void inline write_info_csv(std::ostream &ostream) const {
             ostream.precision(5);
             ostream << std::fixed;
             ostream << "ifragment,bpc,type,s,t0,t1,t2,len,residuals_uint32" << std::endl;
@@ -1550,17 +2309,19 @@ namespace pfa::neats {
                 auto mt = (uint8_t) (model_types_0[imt]) | ((uint8_t) (model_types_1[imt]) << 1);
                 ostream << (uint64_t) (mt) << ",";
 
-                auto t1 = coefficients_t1[offset_coefficients];
-                auto t2 = coefficients_t2[offset_coefficients];
+                auto [_s, _t0, t1, t2] = coefficients_at(offset_coefficients, (typename poa_t::approx_fun_t) (mt),
+                                                         offset_coefficients_s, offset_coefficients_t0);
                 offset_coefficients++;
                 std::optional<x_t> s = std::nullopt;
                 std::optional<T1> t0 = std::nullopt;
 
                 if ((typename poa_t::approx_fun_t) (mt) == poa_t::approx_fun_t::Sqrt) { // Too arbitrary?
-                    s = coefficients_s[offset_coefficients_s++];
+                    s = _s;
+                    offset_coefficients_s++;
                     ostream << (uint64_t) (s.value()) << ",";
                 } else if ((typename poa_t::approx_fun_t) (mt) == poa_t::approx_fun_t::Quadratic) {
-                    t0 = coefficients_t0[offset_coefficients_t0++];
+                    t0 = _t0;
+                    offset_coefficients_t0++;
                     ostream << "," << (float64_alias_t) (t0.value());
                 } else {
                     ostream << ",";
@@ -1588,41 +2349,227 @@ namespace pfa::neats {
             decltype(max_bpc) _max_bpc = 0;
             sdsl::read_member(_max_bpc, is);
             compressor<x_t, y_t, poly, T1, T2> lc{_max_bpc};
-            sdsl::read_member(lc._n, is);
-            sdsl::read_member(lc.residuals_bit_size, is);
+            memory::reset();
+            {
+                memory::scope memory_scope{memory::phase::load};
+                lc.load_members(is);
+            }
+#ifdef USE_MEMORY_ACCOUNTING
+            lc.last_memory = memory::current();
+#endif
+            return lc;
+        }
 
-            lc.starting_positions_ef.load(is);
+        /** Loads a compressor serialized to fn, parsing it from a read-only mapping of the file. */
+        static auto load(const std::string &fn) {
+            huge_pages::mapped_file file(fn);
+            auto data = file.data();
+            std::ispanstream is(data);
+            return load(is);
+        }
+
+    private:
+
+        /** Reads everything but max_bpc, which load needs to construct the compressor. */
+        void load_members(std::istream &is) {
+            sdsl::read_member(_n, is);
+            sdsl::read_member(residuals_bit_size, is);
 
-            sdsl::load(lc.residuals, is);
-            lc.offset_residuals_ef.load(is);
-            sdsl::load(lc.bits_per_correction, is);
-            sdsl::load(lc.model_types_0, is);
-            sdsl::load(lc.model_types_1, is);
-            sdsl::load(lc.qbv, is);
+            starting_positions_ef.load(is);
+
+            sdsl::load(residuals, is);
+            offset_residuals_ef.load(is);
+            sdsl::load(bits_per_correction, is);
+            sdsl::load(model_types_0, is);
+            sdsl::load(model_types_1, is);
+            sdsl::load(qbv, is);
 
             size_t coefficients_t0_size;
             sdsl::read_member(coefficients_t0_size, is);
-            lc.coefficients_t0 = decltype(coefficients_t0)(coefficients_t0_size);
-            sdsl::load_vector<T1>(lc.coefficients_t0, is);
+            coefficients_t0 = decltype(coefficients_t0)(coefficients_t0_size);
+            sdsl::load_vector<T1>(coefficients_t0, is);
 
             size_t coefficients_s_size;
             sdsl::read_member(coefficients_s_size, is);
-            lc.coefficients_s = decltype(lc.coefficients_s)(coefficients_s_size);
-            sdsl::load_vector<x_t>(lc.coefficients_s, is);
+            coefficients_s = decltype(coefficients_s)(coefficients_s_size);
+            sdsl::load_vector<x_t>(coefficients_s, is);
 
             size_t coefficients_t1_size;
             sdsl::read_member(coefficients_t1_size, is);
-            lc.coefficients_t1 = decltype(coefficients_t1)(coefficients_t1_size);
-            sdsl::load_vector<T1>(lc.coefficients_t1, is);
-            lc.coefficients_t2 = decltype(coefficients_t2)(coefficients_t1_size);
-            sdsl::load_vector<T2>(lc.coefficients_t2, is);
+            coefficients_t1 = decltype(coefficients_t1)(coefficients_t1_size);
+            sdsl::load_vector<T1>(coefficients_t1, is);
+            coefficients_t2 = decltype(coefficients_t2)(coefficients_t1_size);
+            sdsl::load_vector<T2>(coefficients_t2, is);
+
+            // streams written before the coefficient codec end here and are not quantized
+            if (is.peek() != std::char_traits<char>::eof())
+                sdsl::read_member(quantized, is);
+            if (quantized)
+                coefficients_packed.load(is);
+            if (is.peek() != std::char_traits<char>::eof())
+                sdsl::read_member(patched, is);
+            if (patched) {
+                sdsl::load(patched_fragments, is);
+                exception_positions.load(is);
+                sdsl::load(exception_values, is);
+            }
+            if (is.peek() != std::char_traits<char>::eof())
+                sdsl::read_member(aggregates, is);
+            if (aggregates) {
+                sdsl::read_member(aggregates_base, is);
+                sdsl::load(fragment_sums, is);
+                sdsl::load(fragment_min, is);
+                sdsl::load(fragment_max, is);
+                build_block_extrema();
+            }
 
-            sdsl::util::init_support(lc.fun_1_rank, &lc.model_types_1);
-            sdsl::util::init_support(lc.quad_fun_rank, &lc.qbv);
+            sdsl::util::init_support(fun_1_rank, &model_types_1);
+            sdsl::util::init_support(quad_fun_rank, &qbv);
+            memory::account(starting_positions_ef, residuals, offset_residuals_ef, bits_per_correction, model_types_0,
+                            model_types_1, qbv, coefficients_t0, coefficients_s, coefficients_t1, coefficients_t2,
+                            fun_1_rank, quad_fun_rank);
+            if (quantized)
+                memory::account(coefficients_packed);
+            if (patched)
+                memory::account(patched_fragments, exception_positions, exception_values);
+            if (aggregates)
+                memory::account(fragment_sums, fragment_min, fragment_max);
+            advise_huge_pages();
+        }
 
-            return lc;
+        /** Decodes [s, e) in chunks and calls on_chunk(position, values, num) on each of them, until it returns false.
+         * Returns false if the decoding was stopped. */
+        template<typename OnChunk>
+        bool decode_chunks(x_t s, x_t e, OnChunk &&on_chunk) const {
+            constexpr x_t chunk = 1024;
+            y_t buffer[chunk];
+            while (s < e) {
+                const auto num = std::min(chunk, x_t(e - s));
+                std::fill(buffer, buffer + num, y_t{0});
+                simd_scan(s, s + num, buffer);
+                if (!on_chunk(s, static_cast<const y_t *>(buffer), num))
+                    return false;
+                s += num;
+            }
+            return true;
+        }
+
+        /** Calls on_values(values, num) on decoded chunks of [from, to) and, when the aggregates are available,
+         * on_fragments(a, b) on the fragments [a, b) that the range covers entirely, which are not decoded. */
+        template<typename OnValues, typename OnFragments>
+        void reduce(x_t from, x_t to, OnValues &&on_values, OnFragments &&on_fragments) const {
+            if (from > to || to > _n)
+                throw std::out_of_range("range out of bounds");
+            if (from == to)
+                return;
+
+            auto decode = [&](x_t s, x_t e) {
+                decode_chunks(s, e, [&](x_t, const y_t *values, x_t num) {
+                    on_values(values, num);
+                    return true;
+                });
+            };
+
+            if (!aggregates) {
+                decode(from, to);
+                return;
+            }
+
+            // [a, b) are the fragments inside [from, to)
+            const auto l = bits_per_correction.size();
+            auto it = starting_positions_ef.predecessor(from);
+            const size_t a = *it == from ? it.index() : it.index() + 1;
+            const size_t b = to == _n ? l : starting_positions_ef.predecessor(to).index();
+            if (a >= b) {
+                decode(from, to);
+                return;
+            }
+            const x_t start_a = starting_positions_ef[a];
+            const x_t start_b = b < l ? x_t(starting_positions_ef[b]) : _n;
+            decode(from, start_a);
+            on_fragments(a, b);
+            decode(start_b, to);
         }
 
+        /** Builds block_min and block_max from fragment_min and fragment_max. The last partial block is left out, its
+         * fragments are read directly. */
+        void build_block_extrema() {
+            auto build = [](const sdsl::int_vector<> &f, std::vector<sdsl::int_vector<>> &levels, auto better) {
+                levels.clear();
+                const auto num_blocks = f.size() / aggregates_block;
+                if (num_blocks == 0)
+                    return;
+                levels.emplace_back(num_blocks, 0, f.width());
+                for (size_t i = 0; i < num_blocks; ++i) {
+                    uint64_t m = f[i * aggregates_block];
+                    for (size_t j = 1; j < aggregates_block; ++j)
+                        m = better(m, uint64_t(f[i * aggregates_block + j]));
+                    levels[0][i] = m;
+                }
+                for (size_t k = 1; (size_t{1} << k) <= num_blocks; ++k) {
+                    const auto half = size_t{1} << (k - 1);
+                    levels.emplace_back(num_blocks - (size_t{1} << k) + 1, 0, f.width());
+                    for (size_t i = 0; i < levels[k].size(); ++i)
+                        levels[k][i] = better(uint64_t(levels[k - 1][i]), uint64_t(levels[k - 1][i + half]));
+                }
+                for (const auto &level: levels)
+                    memory::account(level);
+            };
+            build(fragment_min, block_min, [](uint64_t x, uint64_t y) { return std::min(x, y); });
+            build(fragment_max, block_max, [](uint64_t x, uint64_t y) { return std::max(x, y); });
+        }
+
+        /** Returns the smallest entry of fragment_min (the largest of fragment_max, if max) over the fragments [a, b),
+         * with a < b: the whole blocks inside come from two entries of the sparse table, the rest from at most two
+         * partial blocks. */
+        template<bool max>
+        [[nodiscard]] uint64_t fragment_extremum(size_t a, size_t b) const {
+            const auto &f = max ? fragment_max : fragment_min;
+            const auto &levels = max ? block_max : block_min;
+            auto better = [](uint64_t x, uint64_t y) { return max ? std::max(x, y) : std::min(x, y); };
+
+            // the whole blocks are [first_block, last_block)
+            const auto first_block = (a + aggregates_block - 1) / aggregates_block;
+            const auto last_block = b / aggregates_block;
+            uint64_t m = f[a];
+            if (first_block >= last_block) {
+                for (auto im = a + 1; im < b; ++im)
+                    m = better(m, uint64_t(f[im]));
+                return m;
+            }
+            for (auto im = a + 1; im < first_block * aggregates_block; ++im)
+                m = better(m, uint64_t(f[im]));
+            for (auto im = last_block * aggregates_block; im < b; ++im)
+                m = better(m, uint64_t(f[im]));
+            const auto k = static_cast<size_t>(std::bit_width(last_block - first_block)) - 1;
+            return better(m, better(uint64_t(levels[k][first_block]),
+                                    uint64_t(levels[k][last_block - (size_t{1} << k)])));
+        }
+
+        /** Visits the fragments that overlap [from, to): for each of them, clipped to [s, e), zone(im, s, e) tells
+         * whether it must be decoded, in which case on_chunk is called as in decode_chunks. Without the aggregates
+         * every fragment is decoded. Stops when on_chunk returns false. */
+        template<typename Zone, typename OnChunk>
+        void scan_candidates(x_t from, x_t to, Zone &&zone, OnChunk &&on_chunk) const {
+            if (from > to || to > _n)
+                throw std::out_of_range("range out of bounds");
+            if (from == to)
+                return;
+            if (!aggregates) {
+                decode_chunks(from, to, on_chunk);
+                return;
+            }
+
+            const auto l = bits_per_correction.size();
+            auto im = starting_positions_ef.predecessor(from).index();
+            for (x_t s = from; s < to; ++im) {
+                const x_t end = im + 1 < l ? x_t(starting_positions_ef[im + 1]) : _n;
+                const auto e = std::min(end, to);
+                if (zone(im, s, e) && !decode_chunks(s, e, on_chunk))
+                    return;
+                s = e;
+            }
+        }
 
     };
 }
\ No newline at end of file
@@ -1,66 +1,129 @@
 #pragma once
 
-#include "float_pfa.hpp"
+#include "NeaTS.hpp"
 #include <array>
 #include <tuple>
 
 namespace neats {
 
+    /** Lossy compressor: every value is approximated within the error bound by the function of its fragment, no
+     * residuals are stored. The error bound is a runtime parameter (the template parameter max_error is only its
+     * default), and the coefficients are kept in the packed layout of the lossless compressor (coefficient_codec).
+     *
+     * With a relative bound delta > 0, each value y is fitted within tol = epsilon + delta * |y| (see
+     * piecewise_optimal_approximation::tolerance), so that series spanning orders of magnitude are not over-fitted on
+     * their large values. As the decoder rounds up, every decoded value y' satisfies -(tol + 1) <= y - y' <= tol: for
+     * values with delta * |y| < 1 the relative error can reach (1 + delta * |y|) / |y|. partitioning checks every
+     * value against this bound. The bound refers to the values passed to partitioning, so they should not be
+     * shifted.
+     *
+     * As for the lossless compressor, the const member functions may be called concurrently on a shared instance. */
     template<typename x_t = uint32_t, typename y_t = int64_t, int64_t max_error = 8, typename poly = double, typename T1 = float, typename T2 = double>
     class lossy_compressor {
         using poa_t = pfa::piecewise_optimal_approximation<x_t, y_t, poly, T1, T2>;
         using polygon_t = poa_t::convex_polygon_t;
         //using fun_t = poa_t::fun_t;
 
-        constexpr static auto m = typename poa_t::template pfa_t<max_error, typename poa_t::pla_t, typename poa_t::pea_t, typename poa_t::pqa_t, typename poa_t::psa_t>();
-
-        constexpr static auto num_models = m.size;
+        constexpr static auto num_models = std::to_underlying(poa_t::approx_fun_t::COUNT);
         static_assert(num_models == 4, "The number of models must be 4");
-        using out_t = typename decltype(m)::out_t;
+        using out_t = typename poa_t::pna_fun_t;
 
         using approx_fun_t = typename poa_t::approx_fun_t;
 
         std::vector<out_t> out{};
         x_t _n = 0;
+        int64_t epsilon = max_error;
+        double delta = 0;
+        bool quantized = true;
 
-        std::vector<x_t> starting_positions;
+        MyEliasFano<true> starting_positions_ef;
 
-        sdsl::int_vector<2> model_types{};
+        sdsl::int_vector<> model_types{}; // 2 bits per fragment
 
-        std::vector<T1> coefficients_t0;
-        std::vector<T1> coefficients_t1;
-        std::vector<T2> coefficients_t2;
-        std::vector<x_t> coefficients_s;
+        pfa::neats::coefficient_codec<x_t, T1, T2> coefficients;
 
     public:
 
+        /** If _quantized is true, every coefficient is stored with the coarsest precision that keeps its fragment
+         * within the error bound, otherwise the coefficients are stored verbatim (still bit-packed). */
+        explicit lossy_compressor(int64_t _epsilon = max_error, bool _quantized = true, double _delta = 0)
+                : epsilon{_epsilon}, delta{_delta}, quantized{_quantized} {
+            if (delta < 0 || delta >= 1)
+                throw std::runtime_error("the relative bound must be in [0, 1)");
+        }
+
         inline auto num_partitions() const {
-            return starting_positions.size();
+            return starting_positions_ef.size();
+        }
+
+        /** Returns the function of the fragment im, which starts at start_pos. */
+        inline auto fragment_at(size_t im, x_t start_pos) const {
+            const auto mt = static_cast<approx_fun_t>(model_types[im]);
+            const auto [s, t0, t1, t2] = coefficients.get(im, mt == approx_fun_t::Sqrt, mt == approx_fun_t::Quadratic);
+            return poa_t::piecewise_non_linear_approximation::make_fun(
+                    mt, start_pos, mt == approx_fun_t::Sqrt ? std::optional<x_t>{s} : std::nullopt,
+                    mt == approx_fun_t::Quadratic ? std::optional<T1>{t0} : std::nullopt, t1, t2);
+        }
+
+        inline y_t operator[](x_t i) const {
+            auto it = starting_positions_ef.predecessor(i);
+            auto model = fragment_at(it.index(), static_cast<x_t>(*it));
+            return std::visit([&](auto &&mo) { return mo(i + 1); }, model);
+        }
+
+        /** Writes the approximations of the values in the positions [from, to) to out. */
+        template<typename It>
+        inline void scan(x_t from, x_t to, It out) const {
+            if (from >= to)
+                return;
+            auto it = starting_positions_ef.predecessor(from);
+            auto im = it.index();
+            x_t start = *it;
+            for (auto j = from; j < to; ++im) {
+                x_t end = im + 1 < num_partitions() ? starting_positions_ef[im + 1] : _n;
+                auto e = std::min(end, to);
+                std::visit([&](auto &&mo) {
+                    for (; j < e; ++j)
+                        *(out + (j - from)) = mo(j + 1);
+                }, fragment_at(im, start));
+                start = end;
+            }
         }
 
         // from begin to end the data is already "normalized" (i.e. > 0)
         template<typename It>
         inline void partitioning(It begin, It end) {
+            namespace profiling = pfa::neats::profiling;
+            namespace memory = pfa::neats::memory;
+            profiling::scope profile{profiling::phase::partitioning};
+            memory::scope memory_scope{memory::phase::partitioning};
             const auto n = std::distance(begin, end);
 
             _n = n;
-            std::vector<int64_t> distance(n + 1, std::numeric_limits<int64_t>::max());
+            memory::vector<int64_t> distance(n + 1, std::numeric_limits<int64_t>::max());
             std::array<std::pair<std::make_signed_t<x_t>, std::make_signed_t<x_t>>, num_models> frontier{
                     std::make_pair(0, 0)};
             std::array<out_t, num_models> local_partitions;
 
-            std::vector<std::unique_ptr<out_t>> previous(n + 1);
+            memory::vector<memory::unique_ptr<out_t>> previous(n + 1);
+
+            // one model per approx_fun_t, all with the same error bound
+            typename poa_t::vec_pna_t m(num_models);
+            for (size_t im = 0; im < num_models; ++im)
+                m[im] = poa_t::make_model(static_cast<approx_fun_t>(im), epsilon, delta);
 
             polygon_t g{};
             distance[0] = 0;
 
             for (auto k = 0; k < n; ++k) {
-                m.template for_each([&](auto &&model, auto &&imo) {
-                    auto im = imo;
-
+                profiling::scope relaxations_profile{profiling::phase::relaxations};
+                for (size_t im = 0; im < num_models; ++im) {
                     if (frontier[im].second <= k) { // an edge overlaps the current point (i.e. k)
-                        auto t = pfa::algorithm::make_segment<poa_t>(model, g, (begin + k), end,
-                                                                     frontier[im].second);
+                        profiling::scope segment_profile{static_cast<profiling::phase>(im)};
+                        auto t = std::visit([&](auto &&model) -> std::tuple<x_t, x_t, out_t> {
+                            return pfa::algorithm::make_segment<poa_t>(model, g, (begin + k), end,
+                                                                       frontier[im].second);
+                        }, m[im]);
                         frontier[im].first = std::get<0>(t);
                         frontier[im].second = std::get<1>(t);
                         //assert(frontier[im].first < frontier[im].second - 1);
@@ -70,45 +133,55 @@ namespace neats {
                     if (frontier[im].second > k) {// relax prefix edge (i, k)
                         auto i = frontier[im].first;
                         //auto wik = (double) poa_t::size_in_bits() / ((k - i)*8);
-                        auto wik = std::decay_t<decltype(model)>::fun_t::size_in_bits();
+                        auto wik = fragment_size_in_bits(m[im]);
+                        profiling::count(profiling::counter::edges_relaxed);
 
                         if (distance[k] > distance[i] + wik) {
                             distance[k] = distance[i] + wik;
+                            profiling::count(profiling::counter::distance_improvements);
+                            profiling::scope allocation_profile{profiling::phase::previous_allocations};
                             //previous[k] = std::make_unique<out_t>(local_partitions[im]);
                             std::visit([&](auto &&p) {
-                                previous[k] = std::make_unique<out_t>(p.copy(i));
+                                previous[k] = memory::make_unique<out_t>(p.copy(i));
                             }, local_partitions[im]);
                         }
                     }
-                });
+                }
 
                 //relax suffix edge (k, j)
-                m.template for_each([&](auto &&model, auto &&imo) {
-                    auto im = imo;
+                for (size_t im = 0; im < num_models; ++im) {
                     auto j = frontier[im].second;
-                    auto wkj = std::decay_t<decltype(model)>::fun_t::size_in_bits();
+                    auto wkj = fragment_size_in_bits(m[im]);
+                    profiling::count(profiling::counter::edges_relaxed);
                     if (distance[j] > distance[k] + wkj) {
                         distance[j] = distance[k] + wkj;
+                        profiling::count(profiling::counter::distance_improvements);
+                        profiling::scope allocation_profile{profiling::phase::previous_allocations};
                         std::visit([&](auto &&p) {
-                            previous[j] = std::make_unique<out_t>(p.copy(k));
+                            previous[j] = memory::make_unique<out_t>(p.copy(k));
                         }, local_partitions[im]);
                     }
-                });
+                }
             }
 
             //auto k = std::visit([](auto &&mo) { return mo.get_start(); }, local_partitions[num_models - 1]);
-            auto k = n;
-            while (k != 0) {
-                auto model = std::move(previous[k]);
-                k = std::visit([](auto &&mo) { return mo.get_start(); }, *model);
-                out.push_back(std::move(*model));
-            }
+            {
+                profiling::scope walk_profile{profiling::phase::backward_walk};
+                auto k = n;
+                while (k != 0) {
+                    auto model = std::move(previous[k]);
+                    k = std::visit([](auto &&mo) { return mo.get_start(); }, *model);
+                    out.push_back(std::move(*model));
+                }
 
-            std::reverse(out.begin(), out.end());
+                std::reverse(out.begin(), out.end());
+            }
+            check_fragments(begin, m);
 
             auto num_partitions = out.size();
-            starting_positions = std::vector<x_t>(num_partitions, 0);
-            model_types = sdsl::int_vector<2>(num_partitions, 0);
+            memory::vector<uint64_t> starting_positions(num_partitions, 0);
+            model_types = sdsl::int_vector<>(num_partitions, 0, 2);
+            coefficients = decltype(coefficients){};
 
             for (auto index_model = 0; index_model < out.size(); ++index_model) {
                 auto model = out[index_model];
@@ -119,96 +192,64 @@ namespace neats {
                     return mo.get_start();
                 }, model);
 
-                std::visit([&](auto &&mo) {
-                    auto t = mo.parameters();
-                    if (std::get<0>(t).has_value()) {
-                        coefficients_s.push_back(std::get<0>(t).value());
-                    }
-
-                    if (std::get<1>(t).has_value()) {
-                        coefficients_t0.push_back(std::get<1>(t).value());
-                    }
-                    coefficients_t1.push_back(std::get<2>(t));
-                    coefficients_t2.push_back(std::get<3>(t));
-                }, model);
+                x_t start = starting_positions[index_model];
+                x_t stop = index_model == (out.size() - 1) ? _n : std::visit([](auto &&mo) -> x_t {
+                    return mo.get_start();
+                }, out[index_model + 1]);
+
+                const auto [s, t0, t1, t2] = std::visit([](auto &&mo) { return mo.parameters(); }, model);
+                typename decltype(coefficients)::precision p{};
+                if (quantized) {
+                    // the quantized function must keep every value of the fragment within the error bound
+                    p = coefficients.fit(t0, t1, t2, [&](std::optional<T1> q0, T1 q1, T2 q2) {
+                        auto f = poa_t::piecewise_non_linear_approximation::make_fun(
+                                static_cast<approx_fun_t>(mt), start, s, q0, q1, q2);
+                        return first_out_of_bound(f, begin, start, stop) == stop;
+                    });
+                }
+                coefficients.append(s, t0, t1, t2, p);
             }
 
+            profiling::scope index_profile{profiling::phase::index_construction};
+            starting_positions_ef = MyEliasFano<true>(starting_positions);
+            coefficients.finish();
+
             out.clear();
             out.shrink_to_fit();
         }
 
         template<typename It>
         inline void decompress(It out_begin, It out_end) const {
-
-            const auto make_fun = [&](approx_fun_t mt, x_t start_pos, std::optional<x_t> d, std::optional<T1> t0, T1 t1,
-                                      T2 t2) -> out_t {
-                switch (mt) {
-                    case approx_fun_t::Linear:
-                        assert(!d.has_value());
-                        return typename poa_t::pla_t::fun_t{start_pos, t1, t2};
-                    case approx_fun_t::Quadratic:
-                        assert(!d.has_value());
-                        assert(t0.has_value());
-                        return typename poa_t::pqa_t::fun_t{start_pos, t0.value(), t1, t2};
-                    case approx_fun_t::Sqrt:
-                        assert(d.has_value());
-                        return typename poa_t::psa_t::fun_t{start_pos, d.value(), t1, t2};
-                    case approx_fun_t::Exponential:
-                        assert(!d.has_value());
-                        return typename poa_t::pea_t::fun_t{start_pos, t1, t2};
-                    default:
-                        throw std::runtime_error("Not implemented");
-                }
-            };
-
             auto n = std::distance(out_begin, out_end);
-
             assert(n == _n);
+            scan(0, n, out_begin);
+        }
 
-            x_t start = starting_positions[0];
-
-            auto offset_coefficients = 0;
-            auto offset_coefficients_s = 0;
-            auto offset_coefficients_t0 = 0;
-
-            auto l = starting_positions.size();
-            for (auto index_model = 0; index_model < l; ++index_model) {
-
-                auto end = index_model == (l - 1) ? n : starting_positions[index_model + 1];
-
-                auto imt = index_model;
-                auto mt = model_types[imt];
-
-                auto t1 = coefficients_t1[offset_coefficients];
-                auto t2 = coefficients_t2[offset_coefficients];
-                offset_coefficients++;
-                std::optional<x_t> s = std::nullopt;
-                std::optional<T1> t0 = std::nullopt;
-
-                if ((typename poa_t::approx_fun_t) (mt) == poa_t::approx_fun_t::Sqrt) { // Too arbitrary?
-                    s = coefficients_s[offset_coefficients_s++];
-                } else if ((typename poa_t::approx_fun_t) (mt) == poa_t::approx_fun_t::Quadratic) {
-                    t0 = coefficients_t0[offset_coefficients_t0++];
-                }
-
-                auto model = make_fun((typename poa_t::approx_fun_t) (mt), start, s, t0, t1, t2);
-                for (auto j = start; j < end; ++j) {
-                    auto y = std::visit([&](auto &&mo) { return mo(j + 1); }, model);
-
-                    *(out_begin + j) = y;
-                }
+        /** Writes the approximations of all the values to out, with the vectorized evaluators of the lossless
+         * compressor. */
+        template<typename T>
+        inline void simd_decompress(T *out) const {
+            using evaluator_t = pfa::neats::compressor<x_t, y_t, poly, T1, T2>;
+            std::fill(out, out + _n, T{0});
+
+            auto it_end = starting_positions_ef.at(0);
+            x_t start{0};
+            const auto l = num_partitions();
+            for (size_t index_model = 0; index_model < l; ++index_model) {
+                x_t end = index_model == (l - 1) ? _n : *(++it_end);
+                auto mt = static_cast<approx_fun_t>(model_types[index_model]);
+                const auto [s, t0, t1, t2] = coefficients.get(index_model, mt == approx_fun_t::Sqrt,
+                                                              mt == approx_fun_t::Quadratic);
+                evaluator_t::add_approximation(mt, s, t0, t1, t2, 0, end - start, out + start);
                 start = end;
             }
         }
 
         size_t size_in_bits() const {
             size_t size = 0;
-            size += model_types.size() * 2;
-            size += coefficients_t0.size() * sizeof(T1) * 8;
-            size += coefficients_t1.size() * sizeof(T1) * 8;
-            size += coefficients_t2.size() * sizeof(T2) * 8;
-            size += coefficients_s.size() * sizeof(x_t) * 8;
-            size += starting_positions.size() * sizeof(x_t) * 8;
+            size += model_types.bit_size();
+            size += coefficients.size_in_bits();
+            size += starting_positions_ef.size_in_bytes() * 8;
             return size;
         }
 
@@ -216,81 +257,124 @@ namespace neats {
             return _n;
         }
 
-        constexpr static auto max_err() {
-            return max_error;
+        auto max_err() const {
+            return epsilon;
+        }
+
+        auto max_relative_err() const {
+            return delta;
         }
 
         std::vector<y_t> decompress() const {
             std::vector<y_t> res(_n);
+            if (_n > 0)
+                simd_decompress(res.data());
+            return res;
+        }
 
-            auto num_partitions = starting_positions.size();
-
-            auto offset_coefficients_t0 = 0;
-            auto offset_coefficients_s = 0;
-            auto offset_coefficients = 0;
-
-            uint32_t i_segment = 0;
-            uint32_t start_segment = 0;
-            uint32_t end_segment;
-            x_t i = 0;
-
-            while (i < _n) {
-                if (i_segment >= (num_partitions - 1)) end_segment = _n;
-                else end_segment = starting_positions[i_segment + 1];
-
-                auto t = static_cast<poa_t::approx_fun_t>(model_types[i_segment]);
-                switch (t) {
-                    case poa_t::approx_fun_t::Linear: {
-                        auto slope = coefficients_t1[offset_coefficients];
-                        auto intercept = coefficients_t2[offset_coefficients];
-                        offset_coefficients++;
-                        auto start_pos = starting_positions[i_segment];
-                        for (uint32_t j = start_segment; j < end_segment; ++j) {
-                            res[i++] = std::ceil(slope * (j + 1 - start_pos) + intercept);
-                        }
-                        break;
-                    }
+        inline size_t serialize(std::ostream &os, sdsl::structure_tree_node *v = nullptr,
+                                const std::string &name = "") const {
+            if (_n == 0) {
+                throw std::runtime_error("compressor empty");
+            }
 
-                    case poa_t::approx_fun_t::Quadratic: {
-                        const auto a = coefficients_t0[offset_coefficients_t0++];
-                        const auto b = coefficients_t1[offset_coefficients];
-                        const auto c = coefficients_t2[offset_coefficients];
-                        offset_coefficients++;
-                        auto start_pos = starting_positions[i_segment];
-                        for (uint32_t j = start_segment; j < end_segment; ++j) {
-                            res[i++] = std::ceil(a * (j - start_pos) * (j - start_pos) + b * (j - start_pos) + c);
-                        }
-                        break;
-                    }
+            auto child = sdsl::structure_tree::add_child(v, name, sdsl::util::class_name(*this));
+            size_t written_bytes = 0;
+            written_bytes += sdsl::write_member(epsilon, os, child, "epsilon");
+            written_bytes += sdsl::write_member(delta, os, child, "delta");
+            written_bytes += sdsl::write_member(quantized, os, child, "quantized");
+            written_bytes += sdsl::write_member(_n, os, child, "size");
+            written_bytes += starting_positions_ef.serialize(os, child, "starting_positions_ef");
+            written_bytes += sdsl::serialize(model_types, os, child, "model_types");
+            written_bytes += coefficients.serialize(os, child, "coefficients");
+            sdsl::structure_tree::add_size(child, written_bytes);
+            return written_bytes;
+        }
 
-                    case poa_t::approx_fun_t::Exponential: {
-                        const auto a = coefficients_t1[offset_coefficients];
-                        const auto b = coefficients_t2[offset_coefficients];
-                        offset_coefficients++;
-                        auto start_pos = starting_positions[i_segment];
-                        for (uint32_t j = start_segment; j < end_segment; ++j) {
-                            res[i++] = std::ceil(std::exp(a * ((j - start_pos) + 1)) * b);
-                        }
-                        break;
-                    }
+        static auto load(std::istream &is) {
+            int64_t _epsilon;
+            double _delta;
+            bool _quantized;
+            sdsl::read_member(_epsilon, is);
+            sdsl::read_member(_delta, is);
+            sdsl::read_member(_quantized, is);
+            lossy_compressor<x_t, y_t, max_error, poly, T1, T2> lc{_epsilon, _quantized, _delta};
+            sdsl::read_member(lc._n, is);
+            lc.starting_positions_ef.load(is);
+            sdsl::load(lc.model_types, is);
+            lc.coefficients.load(is);
+            return lc;
+        }
 
-                    case poa_t::approx_fun_t::Sqrt: {
-                        const auto s = coefficients_s[offset_coefficients_s++];
-                        const auto a = coefficients_t1[offset_coefficients];
-                        const auto b = coefficients_t2[offset_coefficients];
-                        offset_coefficients++;
-                        auto start_pos = starting_positions[i_segment];
-                        for (uint32_t j = start_segment; j < end_segment; ++j) {
-                            res[i++] = std::ceil(a * std::sqrt((j - (start_pos - s) + 1)) + b);
-                        }
-                        break;
+    private:
+
+        /** Returns the first position in [from, to) whose value decoded by f is out of its bound (see
+         * piecewise_optimal_approximation::tolerance), or to. */
+        template<typename It>
+        x_t first_out_of_bound(const out_t &f, It begin, x_t from, x_t to) const {
+            return std::visit([&](auto &&mo) {
+                for (auto j = from; j < to; ++j) {
+                    const auto y = *(begin + j);
+                    const auto tol = poa_t::tolerance(y, epsilon, delta);
+                    const auto err = static_cast<double>(y - mo(j + 1));
+                    if (err > tol || err < -(tol + 1))
+                        return j;
+                }
+                return to;
+            }, f);
+        }
+
+        /** Returns the function f of the fragment starting at start as the decoder rebuilds it from the stored
+         * coefficients. */
+        static out_t as_stored(const out_t &f, x_t start) {
+            const auto mt = std::visit([](auto mo) { return mo.type(); }, f); // type() is not const
+            const auto [s, t0, t1, t2] = std::visit([](auto &&mo) { return mo.parameters(); }, f);
+            return poa_t::piecewise_non_linear_approximation::make_fun(mt, start, s, t0, t1, t2);
+        }
+
+        /** The fit bounds the real-valued function of a fragment, but its coefficients are then rounded to T1 and T2
+         * (and the exponential family is fitted in log space), so some values may decode out of their bound. Every
+         * fragment of out is cut before its first such value, and the rest of its range is fitted again from there
+         * with the same model; a value that does not fit even at the start of a fragment gets a constant fragment of
+         * its own, which decodes it exactly. */
+        template<typename It>
+        void check_fragments(It begin, typename poa_t::vec_pna_t &m) {
+            auto start_of = [](const out_t &f) { return std::visit([](auto &&mo) -> x_t { return mo.get_start(); }, f); };
+            std::vector<out_t> checked;
+            checked.reserve(out.size());
+            polygon_t g{};
+            for (size_t im = 0; im < out.size(); ++im) {
+                const auto stop = im + 1 < out.size() ? start_of(out[im + 1]) : _n;
+                const auto mt = std::visit([](auto &&mo) { return std::to_underlying(mo.type()); }, out[im]);
+                auto pos = start_of(out[im]);
+                auto f = as_stored(out[im], pos);
+                auto f_end = stop;
+                while (pos < stop) {
+                    const auto bad = first_out_of_bound(f, begin, pos, f_end);
+                    if (bad > pos) {
+                        checked.push_back(f);
+                        pos = bad;
+                    } else {
+                        checked.push_back(poa_t::piecewise_non_linear_approximation::make_fun(
+                                approx_fun_t::Linear, pos, std::nullopt, std::nullopt, T1{0},
+                                static_cast<T2>(*(begin + pos))));
+                        ++pos;
+                    }
+                    if (pos < stop) {
+                        auto t = std::visit([&](auto &&model) -> std::tuple<x_t, x_t, out_t> {
+                            return pfa::algorithm::make_segment<poa_t>(model, g, begin + pos, begin + stop, pos);
+                        }, m[mt]);
+                        f = as_stored(std::get<2>(t), pos);
+                        f_end = std::min<x_t>(std::get<1>(t), stop);
                     }
                 }
-                ++i_segment;
-                start_segment = end_segment;
             }
-            return res;
+            out = std::move(checked);
         }
 
+        static size_t fragment_size_in_bits(const typename poa_t::pna_t &model) {
+            return std::visit([](auto &&mo) -> size_t { return std::decay_t<decltype(mo)>::fun_t::size_in_bits(); },
+                              model);
+        }
     };
-}
\ No newline at end of file
+}
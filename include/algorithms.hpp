@@ -24,14 +24,43 @@
 
 namespace pfa::algorithm {
 
+    /** Points that may be skipped by a patched segment: never two in a row and at most one every exception_every. */
+    constexpr uint32_t exception_every = 16;
+
+    /** Computes the longest segment starting at start_x. If exceptions is not null, a point that does not fit the
+     * current polygon is skipped (and its position appended to exceptions) instead of closing the segment, as long as
+     * the exceptions stay sparse. */
     template<typename poa_t, typename It, typename T, bool quadratic = std::is_same_v<T, typename poa_t::pqa_t>>
-    inline auto make_segment(const T &pa, typename poa_t::convex_polygon_t &g, It begin, It end, uint32_t start_x) {
+    inline auto make_segment(const T &pa, typename poa_t::convex_polygon_t &g, It begin, It end, uint32_t start_x,
+                             std::vector<uint32_t> *exceptions = nullptr) {
         //using out_t = std::tuple<typename poa_t::x_t, typename poa_t::x_t, typename T::fun_t>;
 
         uint32_t n = std::distance(begin, end);
         typename poa_t::data_point last_starting_point;
         typename poa_t::data_point p0;
 
+        if (exceptions != nullptr)
+            exceptions->clear();
+        uint32_t last_exception = 0;
+        auto skip = [&](uint32_t i, const typename poa_t::data_point &dp) {
+            if (exceptions == nullptr || last_exception + 1 == i ||
+                (exceptions->size() + 1) * exception_every > i + exception_every)
+                return false;
+            bool fits;
+            if constexpr (quadratic) {
+                auto [u, l] = pa.compute_bounds(p0, dp);
+                fits = g.can_update(u, l);
+            } else {
+                auto [u, l] = pa.compute_bounds(dp);
+                fits = g.can_update(u, l);
+            }
+            if (fits)
+                return false;
+            exceptions->push_back(start_x + (i - 1));
+            last_exception = i;
+            return true;
+        };
+
         bool intersect;
         for (uint32_t i = 1; i <= n; ++i) {
             //typename poa_t::y_t last_value;
@@ -45,9 +74,13 @@ namespace pfa::algorithm {
                     continue;
                 } else {
                     dp.first = i - 1;
+                    if (skip(i, dp))
+                        continue;
                     intersect = pa.add_point(g, p0, dp);
                 }
             } else {
+                if (skip(i, dp))
+                    continue;
                 intersect = pa.add_point(g, dp);
             }
 
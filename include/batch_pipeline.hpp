@@ -0,0 +1,293 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "NeaTS.hpp"
+
+namespace pfa::neats::batch {
+
+    /** Per-stage counters. Busy time is spent doing the stage's work, blocked time is spent waiting on a full
+     * output queue (i.e. backpressure from the next stage), idle time is spent waiting on an empty input queue. */
+    struct stage_counters {
+        std::atomic<uint64_t> items{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> busy_ns{0};
+        std::atomic<uint64_t> blocked_ns{0};
+        std::atomic<uint64_t> idle_ns{0};
+        std::atomic<uint64_t> failures{0};
+
+        void print(std::ostream &os, const std::string &name, uint32_t num_threads, double wall_ns) const {
+            auto busy = static_cast<double>(busy_ns.load());
+            os << name << "," << num_threads << "," << items.load() << "," << bytes.load() << ","
+               << (items.load() / (wall_ns / 1e9)) << ","
+               << ((bytes.load() / 1e6) / (wall_ns / 1e9)) << ","
+               << (busy / (wall_ns * num_threads)) << ","
+               << (blocked_ns.load() / 1e6) << ","
+               << (idle_ns.load() / 1e6) << ","
+               << failures.load() << std::endl;
+        }
+    };
+
+    /** A blocking FIFO with a fixed capacity: push() waits while the queue is full, pop() waits while it is empty and
+     * returns std::nullopt once the queue has been closed and drained. */
+    template<typename T>
+    class bounded_queue {
+        std::deque<T> items;
+        std::mutex m;
+        std::condition_variable not_full;
+        std::condition_variable not_empty;
+        size_t capacity;
+        bool closed = false;
+
+    public:
+
+        explicit bounded_queue(size_t capacity) : capacity{std::max<size_t>(capacity, 1)} {}
+
+        /** Returns the nanoseconds spent waiting for a free slot. */
+        uint64_t push(T &&item) {
+            auto t1 = std::chrono::steady_clock::now();
+            std::unique_lock lock(m);
+            not_full.wait(lock, [&] { return items.size() < capacity || closed; });
+            auto t2 = std::chrono::steady_clock::now();
+            if (closed)
+                throw std::runtime_error("push on a closed queue");
+            items.push_back(std::move(item));
+            lock.unlock();
+            not_empty.notify_one();
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+        }
+
+        std::optional<T> pop(uint64_t &waited_ns) {
+            auto t1 = std::chrono::steady_clock::now();
+            std::unique_lock lock(m);
+            not_empty.wait(lock, [&] { return !items.empty() || closed; });
+            auto t2 = std::chrono::steady_clock::now();
+            waited_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+            if (items.empty())
+                return std::nullopt;
+            auto item = std::move(items.front());
+            items.pop_front();
+            lock.unlock();
+            not_full.notify_one();
+            return item;
+        }
+
+        void close() {
+            {
+                std::lock_guard lock(m);
+                closed = true;
+            }
+            not_full.notify_all();
+            not_empty.notify_all();
+        }
+    };
+
+    struct options {
+        int64_t bpc = 32;
+        bool first_is_size = true;
+        bool verify = true;
+        uint32_t num_readers = 2;
+        uint32_t num_workers = std::max(1u, std::thread::hardware_concurrency());
+        uint32_t num_writers = 2;
+        size_t queue_capacity = 8; // in series, per queue
+        std::filesystem::path out_dir{};
+    };
+
+    /** Compresses a list of files with a bounded read -> compress -> write pipeline.
+     *
+     * Readers prefetch the upcoming files, a pool of workers runs partitioning (and optionally checks the result with
+     * simd_decompress), writers serialize the compressed series to `out_dir/<stem>.neats`. Every output file starts
+     * with the shift applied by `_preprocess_data`, so that the original values can be restored after `load`. */
+    template<typename compressor_t = pfa::neats::compressor<uint32_t, int64_t, double, float, double>>
+    class pipeline {
+
+        struct raw_series {
+            std::filesystem::path fn;
+            std::vector<int64_t> data;
+            int64_t shift;
+        };
+
+        // compressors are kept behind a pointer: moving them would leave the rank supports pointing to the old
+        // bit_vectors
+        struct compressed_series {
+            std::filesystem::path fn;
+            std::unique_ptr<compressor_t> compressor;
+            int64_t shift;
+        };
+
+        options opts;
+
+    public:
+
+        stage_counters read_counters;
+        stage_counters compress_counters;
+        stage_counters write_counters;
+        double wall_ns = 0;
+
+        explicit pipeline(options o) : opts{std::move(o)} {}
+
+        void run(const std::vector<std::filesystem::path> &fns) {
+            bounded_queue<raw_series> read_q(opts.queue_capacity);
+            bounded_queue<compressed_series> write_q(opts.queue_capacity);
+
+            std::atomic<size_t> next_fn{0};
+            std::atomic<uint32_t> active_readers{opts.num_readers};
+            std::atomic<uint32_t> active_workers{opts.num_workers};
+
+            auto reader = [&] {
+                for (auto i = next_fn++; i < fns.size(); i = next_fn++) {
+                    auto t1 = std::chrono::steady_clock::now();
+                    std::optional<raw_series> s;
+                    try {
+                        s = read(fns[i]);
+                    } catch (const std::exception &e) {
+                        std::cerr << fns[i] << ": " << e.what() << std::endl;
+                        read_counters.failures++;
+                    }
+                    auto t2 = std::chrono::steady_clock::now();
+                    read_counters.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+                    if (!s.has_value())
+                        continue;
+                    read_counters.items++;
+                    read_counters.bytes += s->data.size() * sizeof(int64_t);
+                    read_counters.blocked_ns += read_q.push(std::move(*s));
+                }
+                if (--active_readers == 0)
+                    read_q.close();
+            };
+
+            auto worker = [&] {
+                uint64_t waited;
+                while (auto s = read_q.pop(waited)) {
+                    compress_counters.idle_ns += waited;
+                    auto t1 = std::chrono::steady_clock::now();
+                    std::optional<compressed_series> c;
+                    auto fn = s->fn;
+                    try {
+                        c = compress(std::move(*s));
+                    } catch (const std::exception &e) {
+                        std::cerr << fn << ": " << e.what() << std::endl;
+                        compress_counters.failures++;
+                    }
+                    auto t2 = std::chrono::steady_clock::now();
+                    compress_counters.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+                    if (!c.has_value())
+                        continue;
+                    compress_counters.items++;
+                    compress_counters.bytes += c->compressor->size() * sizeof(int64_t);
+                    compress_counters.blocked_ns += write_q.push(std::move(*c));
+                }
+                compress_counters.idle_ns += waited;
+                if (--active_workers == 0)
+                    write_q.close();
+            };
+
+            auto writer = [&] {
+                uint64_t waited;
+                while (auto c = write_q.pop(waited)) {
+                    write_counters.idle_ns += waited;
+                    auto t1 = std::chrono::steady_clock::now();
+                    try {
+                        write_counters.bytes += write(*c);
+                        write_counters.items++;
+                    } catch (const std::exception &e) {
+                        std::cerr << c->fn << ": " << e.what() << std::endl;
+                        write_counters.failures++;
+                    }
+                    auto t2 = std::chrono::steady_clock::now();
+                    write_counters.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+                }
+                write_counters.idle_ns += waited;
+            };
+
+            auto t1 = std::chrono::steady_clock::now();
+            {
+                std::vector<std::jthread> threads;
+                for (uint32_t i = 0; i < opts.num_readers; ++i) threads.emplace_back(reader);
+                for (uint32_t i = 0; i < opts.num_workers; ++i) threads.emplace_back(worker);
+                for (uint32_t i = 0; i < opts.num_writers; ++i) threads.emplace_back(writer);
+            }
+            auto t2 = std::chrono::steady_clock::now();
+            wall_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count());
+        }
+
+        void print_counters(std::ostream &os, bool header = true) const {
+            if (header)
+                os << "stage,threads,items,bytes,items/s,MB/s,utilization,blocked(ms),idle(ms),failures" << std::endl;
+            read_counters.print(os, "read", opts.num_readers, wall_ns);
+            compress_counters.print(os, "compress", opts.num_workers, wall_ns);
+            write_counters.print(os, "write", opts.num_writers, wall_ns);
+        }
+
+    private:
+
+        raw_series read(const std::filesystem::path &fn) const {
+            std::ifstream in(fn, std::ios::binary | std::ios::ate);
+            if (!in)
+                throw std::runtime_error("cannot open file");
+            auto bytes = static_cast<size_t>(in.tellg());
+            in.seekg(0);
+
+            size_t size = bytes / sizeof(int64_t);
+            if (opts.first_is_size) {
+                if (bytes < sizeof(size_t))
+                    throw std::runtime_error("missing size header");
+                in.read(reinterpret_cast<char *>(&size), sizeof(size_t));
+                size = std::min(size, (bytes - sizeof(size_t)) / sizeof(int64_t));
+            }
+            if (size == 0)
+                throw std::runtime_error("empty series");
+
+            std::vector<int64_t> data(size);
+            in.read(reinterpret_cast<char *>(data.data()), size * sizeof(int64_t));
+            if (!in)
+                throw std::runtime_error("short read");
+
+            auto min_data = *std::min_element(data.begin(), data.end());
+            min_data = min_data < 0 ? (min_data - 1) : -1;
+            auto shift = min_data - static_cast<int64_t>(BPC_TO_EPSILON(opts.bpc));
+            for (auto &d: data)
+                d -= shift;
+            return {fn, std::move(data), shift};
+        }
+
+        compressed_series compress(raw_series &&s) const {
+            auto c = std::make_unique<compressor_t>(static_cast<uint8_t>(opts.bpc));
+            c->partitioning(s.data.begin(), s.data.end());
+
+            if (opts.verify) {
+                huge_pages::vector<int64_t> decompressed(c->size());
+                c->simd_decompress(decompressed.data());
+                if (!std::equal(decompressed.begin(), decompressed.end(), s.data.begin()))
+                    throw std::runtime_error("decompressed data does not match the input");
+            }
+            return {std::move(s.fn), std::move(c), s.shift};
+        }
+
+        size_t write(const compressed_series &c) const {
+            auto out_fn = opts.out_dir / c.fn.filename().replace_extension(".neats");
+            std::ofstream out(out_fn, std::ios::binary | std::ios::trunc);
+            if (!out)
+                throw std::runtime_error("cannot create " + out_fn.string());
+            size_t written_bytes = sdsl::write_member(c.shift, out);
+            written_bytes += c.compressor->serialize(out);
+            if (!out)
+                throw std::runtime_error("write failed");
+            return written_bytes;
+        }
+    };
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <sdsl/int_vector.hpp>
+#include <sdsl/io.hpp>
+#include <sdsl/structure_tree.hpp>
+
+#include "my_elias_fano.hpp"
+
+namespace pfa::neats {
+
+    /** Bit-packed storage for the fragment coefficients (s, t0, t1, t2) with per-fragment precision.
+     *
+     * Every fragment is stored as a variable-length record; the end of each record is kept in an Elias-Fano sequence
+     * (the same layout used for the residuals), so that the coefficients of any fragment are decoded in O(1).
+     * A record is laid out as:
+     *
+     *   m1 | t1 | [t0] | [width(s) | s] | f2 | (width(delta) | zigzag(delta)) or raw t2
+     *
+     * t1 and t0 keep the sign, the exponent and the m1 most significant bits of the mantissa. t2 is stored in fixed
+     * point with f2 fractional bits, as a delta from the rounded t2 of the first fragment of its block (one anchor
+     * every `anchor_every` fragments keeps decoding O(1)); f2 == f2_raw means that t2 is stored verbatim. */
+    template<typename x_t = uint32_t, typename T1 = float, typename T2 = double>
+    class coefficient_codec {
+        using t1_bits_t = std::conditional_t<sizeof(T1) == 4, uint32_t, uint64_t>;
+        using t2_bits_t = std::conditional_t<sizeof(T2) == 4, uint32_t, uint64_t>;
+
+        static constexpr uint8_t t1_mantissa = std::numeric_limits<T1>::digits - 1;
+        static constexpr uint8_t t1_width = sizeof(T1) * 8;
+        static constexpr uint8_t t2_width = sizeof(T2) * 8;
+        static constexpr uint8_t m1_width = std::bit_width(t1_mantissa);
+        static constexpr uint8_t s_width = std::bit_width(sizeof(x_t) * 8);
+        static constexpr uint8_t f2_width = 5;
+        static constexpr uint8_t f2_raw = (1 << f2_width) - 1;
+        static constexpr uint8_t delta_width = 7;
+        static constexpr size_t anchor_every = 32;
+
+        sdsl::int_vector<64> data{};
+        MyEliasFano<false> offsets_ef{};
+        std::vector<int64_t> anchors{};
+        size_t n = 0;
+
+        // only used while appending
+        std::vector<uint64_t> offsets{};
+        uint64_t bit_size = 0;
+
+    public:
+
+        struct precision {
+            uint8_t m1 = t1_mantissa;
+            uint8_t f2 = f2_raw;
+        };
+
+        coefficient_codec() = default;
+
+        [[nodiscard]] bool empty() const {
+            return n == 0;
+        }
+
+        [[nodiscard]] size_t size() const {
+            return n;
+        }
+
+        /** Rounds v to the nearest value that has only m1 bits of mantissa. */
+        static T1 round_t1(T1 v, uint8_t m1) {
+            if (m1 >= t1_mantissa || !std::isfinite(v))
+                return v;
+            const uint8_t drop = t1_mantissa - m1;
+            auto bits = std::bit_cast<t1_bits_t>(v);
+            bits += t1_bits_t{1} << (drop - 1);
+            bits &= ~((t1_bits_t{1} << drop) - 1);
+            return std::bit_cast<T1>(bits);
+        }
+
+        /** Rounds v to a multiple of 2^-f2, returns std::nullopt if the delta from the anchor does not fit in 63 bits. */
+        static std::optional<T2> round_t2(T2 v, uint8_t f2, int64_t anchor) {
+            if (f2 == f2_raw)
+                return v;
+            auto delta = delta_t2(v, f2, anchor);
+            if (!delta.has_value())
+                return std::nullopt;
+            return std::ldexp(static_cast<T2>(*delta + (static_cast<__int128>(anchor) << f2)), -f2);
+        }
+
+        /** Returns the anchor that the next appended fragment will be delta-coded against. */
+        [[nodiscard]] int64_t next_anchor(T2 t2) const {
+            if (n % anchor_every != 0)
+                return anchors.back();
+            return std::isfinite(t2) && std::fabs(t2) < 0x1p52 ? std::llround(t2) : 0;
+        }
+
+        /** Finds the coarsest precision for which fits(t0, t1, t2) still holds on the quantized coefficients, starting
+         * from the exact ones. fits is called O(log(mantissa bits) + log(f2_raw)) times. */
+        template<typename F>
+        precision fit(std::optional<T1> t0, T1 t1, T2 t2, F &&fits) const {
+            static_assert(std::is_floating_point_v<T1> && (sizeof(T1) == 4 || sizeof(T1) == 8));
+            static_assert(std::is_floating_point_v<T2> && (sizeof(T2) == 4 || sizeof(T2) == 8));
+            precision p{};
+            auto anchor = next_anchor(t2);
+            auto q0 = [&](uint8_t m1) { return t0.has_value() ? std::optional<T1>{round_t1(*t0, m1)} : t0; };
+
+            if (!fits(t0, t1, t2))
+                return p;
+
+            uint8_t lo = 0, hi = t1_mantissa;
+            while (lo < hi) {
+                uint8_t mid = (lo + hi) / 2;
+                if (fits(q0(mid), round_t1(t1, mid), t2)) hi = mid;
+                else lo = mid + 1;
+            }
+            p.m1 = hi;
+
+            lo = 0;
+            hi = f2_raw;
+            while (lo < hi) {
+                uint8_t mid = (lo + hi) / 2;
+                auto q2 = round_t2(t2, mid, anchor);
+                if (q2.has_value() && fits(q0(p.m1), round_t1(t1, p.m1), *q2)) hi = mid;
+                else lo = mid + 1;
+            }
+            p.f2 = hi;
+            return p;
+        }
+
+        /** Appends the record of the next fragment, the values are quantized with the given precision. Returns the
+         * coefficients as they will be decoded. */
+        std::tuple<std::optional<x_t>, std::optional<T1>, T1, T2>
+        append(std::optional<x_t> s, std::optional<T1> t0, T1 t1, T2 t2, precision p) {
+            auto anchor = next_anchor(t2);
+            if (n % anchor_every == 0)
+                anchors.push_back(anchor);
+            ++n;
+
+            reserve(bit_size + m1_width + 2 * t1_width + s_width + 64 + f2_width + delta_width + 64);
+            write(p.m1, m1_width);
+            t1 = round_t1(t1, p.m1);
+            write(std::bit_cast<t1_bits_t>(t1) >> (t1_mantissa - p.m1), t1_width - t1_mantissa + p.m1);
+            if (t0.has_value()) {
+                t0 = round_t1(*t0, p.m1);
+                write(std::bit_cast<t1_bits_t>(*t0) >> (t1_mantissa - p.m1), t1_width - t1_mantissa + p.m1);
+            }
+            if (s.has_value()) {
+                const uint8_t w = std::bit_width(static_cast<uint64_t>(*s));
+                write(w, s_width);
+                write(*s, w);
+            }
+
+            auto delta = p.f2 == f2_raw ? std::nullopt : delta_t2(t2, p.f2, anchor);
+            if (!delta.has_value()) {
+                write(f2_raw, f2_width);
+                write(std::bit_cast<t2_bits_t>(t2), t2_width);
+            } else {
+                const auto zz = (static_cast<uint64_t>(*delta) << 1) ^ static_cast<uint64_t>(*delta >> 63);
+                const uint8_t w = std::bit_width(zz);
+                write(p.f2, f2_width);
+                write(w, delta_width);
+                write(zz, w);
+                t2 = *round_t2(t2, p.f2, anchor);
+            }
+            offsets.push_back(bit_size);
+            return {s, t0, t1, t2};
+        }
+
+        /** Must be called after the last append. */
+        void finish() {
+            data.resize(CEIL_UINT_DIV(bit_size, 64) + 1);
+            if (!offsets.empty())
+                offsets_ef = MyEliasFano<false>(offsets);
+            offsets.clear();
+            offsets.shrink_to_fit();
+        }
+
+        /** Decodes the coefficients of the i-th fragment, s and t0 are 0 when the fragment does not have them. */
+        [[nodiscard]] inline std::tuple<x_t, T1, T1, T2> get(size_t i, bool has_s, bool has_t0) const {
+            uint64_t offset = i == 0 ? 0 : offsets_ef[i - 1];
+            auto read = [&](uint8_t len) -> uint64_t {
+                auto v = sdsl::bits::read_int(data.data() + (offset >> 6u), offset & 0x3F, len);
+                offset += len;
+                return v;
+            };
+
+            const auto m1 = static_cast<uint8_t>(read(m1_width));
+            const uint8_t drop = t1_mantissa - m1;
+            const auto t1 = std::bit_cast<T1>(static_cast<t1_bits_t>(read(t1_width - drop) << drop));
+            T1 t0{0};
+            if (has_t0)
+                t0 = std::bit_cast<T1>(static_cast<t1_bits_t>(read(t1_width - drop) << drop));
+            x_t s{0};
+            if (has_s)
+                s = static_cast<x_t>(read(static_cast<uint8_t>(read(s_width))));
+
+            const auto f2 = static_cast<uint8_t>(read(f2_width));
+            T2 t2;
+            if (f2 == f2_raw) {
+                t2 = std::bit_cast<T2>(static_cast<t2_bits_t>(read(t2_width)));
+            } else {
+                const auto zz = read(static_cast<uint8_t>(read(delta_width)));
+                const auto delta = static_cast<int64_t>(zz >> 1) ^ -static_cast<int64_t>(zz & 1);
+                const auto anchor = anchors[i / anchor_every];
+                t2 = std::ldexp(static_cast<T2>(delta + (static_cast<__int128>(anchor) << f2)), -f2);
+            }
+            return {s, t0, t1, t2};
+        }
+
+        [[nodiscard]] size_t size_in_bits() const {
+            return data.bit_size() + offsets_ef.size_in_bytes() * 8 + anchors.size() * sizeof(int64_t) * 8;
+        }
+
+        inline size_t serialize(std::ostream &os, sdsl::structure_tree_node *v = nullptr,
+                                const std::string &name = "") const {
+            auto child = sdsl::structure_tree::add_child(v, name, sdsl::util::class_name(*this));
+            size_t written_bytes = 0;
+            written_bytes += sdsl::write_member(n, os, child, "n");
+            written_bytes += sdsl::serialize(data, os, child, "data");
+            if (n > 0)
+                written_bytes += offsets_ef.serialize(os, child, "offsets_ef");
+            written_bytes += sdsl::write_member(anchors.size(), os, child, "anchors.size()");
+            written_bytes += sdsl::serialize_vector(anchors, os, child, "anchors");
+            sdsl::structure_tree::add_size(child, written_bytes);
+            return written_bytes;
+        }
+
+        void load(std::istream &is) {
+            sdsl::read_member(n, is);
+            sdsl::load(data, is);
+            if (n > 0)
+                offsets_ef.load(is);
+            size_t anchors_size;
+            sdsl::read_member(anchors_size, is);
+            anchors = std::vector<int64_t>(anchors_size);
+            sdsl::load_vector(anchors, is);
+        }
+
+    private:
+
+        static std::optional<int64_t> delta_t2(T2 v, uint8_t f2, int64_t anchor) {
+            if (!std::isfinite(v) || std::fabs(v) >= std::ldexp(T2{1}, 62 - f2))
+                return std::nullopt;
+            auto q = static_cast<__int128>(std::llround(std::ldexp(v, f2)));
+            auto delta = q - (static_cast<__int128>(anchor) << f2);
+            if (delta > std::numeric_limits<int64_t>::max() / 2 || delta < std::numeric_limits<int64_t>::min() / 2)
+                return std::nullopt;
+            return static_cast<int64_t>(delta);
+        }
+
+        void reserve(uint64_t bits) {
+            auto words = CEIL_UINT_DIV(bits, 64) + 1;
+            if (words > data.size())
+                data.resize(std::max<uint64_t>(words, data.size() * 2));
+        }
+
+        void write(uint64_t v, uint8_t len) {
+            if (len == 0)
+                return;
+            sdsl::bits::write_int(data.data() + (bit_size >> 6u), v, bit_size & 0x3F, len);
+            bit_size += len;
+        }
+    };
+}
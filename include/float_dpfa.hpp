@@ -9,6 +9,8 @@
 #include <optional>
 #include <variant>
 #include <algorithm>
+#include "memory_accounting.hpp"
+#include "profiling.hpp"
 
 namespace pfa {
 
@@ -195,9 +197,9 @@ namespace pfa {
             }
         };
 
-        std::vector<segment_t> upper{};
+        neats::memory::vector<segment_t> upper{};
         uint32_t up_start{0};
-        std::vector<segment_t> lower{};
+        neats::memory::vector<segment_t> lower{};
         uint32_t lo_start{0};
 
     public:
@@ -253,6 +255,7 @@ namespace pfa {
 
         template<bool Upper>
         inline auto cut(const halfplane<Upper> &u) const {
+            neats::profiling::count(neats::profiling::counter::polygon_cuts);
 
             auto index_seg_u = search_intersection(upper.begin() + up_start, upper.end(), u);
             auto index_seg_l = search_intersection(lower.rbegin(), lower.rend() - lo_start, u);
@@ -312,6 +315,7 @@ namespace pfa {
         }
 
         inline bool update(const upperbound_t &u, const lowerbound_t &l) {
+            neats::profiling::scope profile{neats::profiling::phase::polygon_update};
             //assert(u1.sign() == 0 && l1.sign() == 1);
             if (empty()) {
                 init = boundaries_t{u, l};
@@ -382,6 +386,15 @@ namespace pfa {
             }
         }
 
+        /** Returns whether update(u, l) would succeed, without modifying the polygon. The two bounds are parallel, so
+         * the polygon meets the strip between them iff it meets each of the two half-planes. */
+        inline bool can_update(const upperbound_t &u, const lowerbound_t &l) {
+            if (empty() || is_init())
+                return true;
+            auto meets = [](const auto &v) { return !std::holds_alternative<bool>(v) || std::get<bool>(v); };
+            return meets(cut_with_lower_bound(l)) && meets(cut_with_upper_bound(u));
+        }
+
         [[nodiscard]] constexpr bool empty() const {
             return upper.empty() && lower.empty() && !is_init();
         }
@@ -31,20 +31,33 @@ namespace pfa {
 
     public:
 
+        /** Error allowed around y by the fit: epsilon, plus delta * |y| when the relative bound delta is set. It is not
+         * truncated, so that a small y keeps a bound wider than 0. The fitted function stays within y +- tolerance, and
+         * its ceil (the decoded value) within -(tolerance + 1) <= y - decoded <= tolerance. */
+        static inline double tolerance(y_t y, int64_t epsilon, double delta) {
+            if (delta <= 0)
+                return static_cast<double>(epsilon);
+            return static_cast<double>(epsilon) + delta * std::abs(static_cast<double>(y));
+        }
+
         struct piecewise_linear_approximation {
 
             int64_t epsilon{};
+            double delta{}; // relative bound, see tolerance()
 
             constexpr explicit piecewise_linear_approximation() : epsilon{2L} {}
             constexpr explicit piecewise_linear_approximation(const int64_t &e) : epsilon{e} {}
 
+            constexpr piecewise_linear_approximation(const int64_t &e, double d) : epsilon{e}, delta{d} {}
+
             boundaries_t compute_bounds(const data_point &p) const {
                 assert(p.first > 0);
 
                 auto m = -static_cast<y_t>(p.first);
 
-                auto _uq = p.second + epsilon;
-                auto _lq = p.second - epsilon;
+                const auto e = tolerance(p.second, epsilon, delta);
+                auto _uq = static_cast<polygon_t>(p.second) + e;
+                auto _lq = static_cast<polygon_t>(p.second) - e;
 
                 lowerbound_t l{typename convex_polygon_t::segment_t(m, _lq)};
                 upperbound_t u{typename convex_polygon_t::segment_t(m, _uq)};
@@ -226,18 +239,22 @@ namespace pfa {
         struct piecewise_sqrt_approximation {
 
             int64_t epsilon{};
+            double delta{}; // relative bound, see tolerance()
 
             constexpr explicit piecewise_sqrt_approximation() : epsilon{2L} {}
 
             constexpr explicit piecewise_sqrt_approximation(const int64_t &e) : epsilon{e} {}
 
+            constexpr piecewise_sqrt_approximation(const int64_t &e, double d) : epsilon{e}, delta{d} {}
+
             boundaries_t compute_bounds(const data_point &p) const {
                 assert(p.first > 0);
 
                 auto m = -std::sqrt(static_cast<polygon_t>(p.first));
 
-                auto _uq = p.second + epsilon;
-                auto _lq = p.second - epsilon;
+                const auto e = tolerance(p.second, epsilon, delta);
+                auto _uq = static_cast<polygon_t>(p.second) + e;
+                auto _lq = static_cast<polygon_t>(p.second) - e;
 
                 lowerbound_t l{typename convex_polygon_t::segment_t(m, _lq)};
                 upperbound_t u{typename convex_polygon_t::segment_t(m, _uq)};
@@ -383,11 +400,14 @@ namespace pfa {
         struct piecewise_exponential_approximation {
 
             int64_t epsilon{};
+            double delta{}; // relative bound, see tolerance()
 
             constexpr explicit piecewise_exponential_approximation() : epsilon{2L} {}
 
             constexpr explicit piecewise_exponential_approximation(const int64_t &e) : epsilon{e} {}
 
+            constexpr piecewise_exponential_approximation(const int64_t &e, double d) : epsilon{e}, delta{d} {}
+
             boundaries_t compute_bounds(const data_point &p) const {
                 assert(p.first > 0);
 
@@ -395,8 +415,9 @@ namespace pfa {
 
                 typename convex_polygon_t::value_t _uq, _lq;
 
-                _uq = std::log(static_cast<convex_polygon_t::value_t>(p.second + epsilon));
-                _lq = std::log(static_cast<convex_polygon_t::value_t>(p.second - epsilon));
+                const auto e = tolerance(p.second, epsilon, delta);
+                _uq = std::log(static_cast<convex_polygon_t::value_t>(p.second) + e);
+                _lq = std::log(static_cast<convex_polygon_t::value_t>(p.second) - e);
 
                 lowerbound_t l{typename convex_polygon_t::segment_t(m, _lq)};
                 upperbound_t u{typename convex_polygon_t::segment_t(m, _uq)};
@@ -580,17 +601,22 @@ namespace pfa {
         struct piecewise_quadratic_approximation {
 
             int64_t epsilon{};
+            double delta{}; // relative bound, see tolerance()
 
             constexpr explicit piecewise_quadratic_approximation() : epsilon{2L} {}
 
             constexpr explicit piecewise_quadratic_approximation(const int64_t &e) : epsilon{e} {}
 
+            constexpr piecewise_quadratic_approximation(const int64_t &e, double d) : epsilon{e}, delta{d} {}
+
             boundaries_t compute_bounds(const data_point& p0, const data_point &p) const {
 
                 auto m = -static_cast<polygon_t>(p0.first + p.first);
 
-                auto _lq = ((p.second - epsilon) - p0.second) / static_cast<polygon_t>(p.first - p0.first);
-                auto _uq = ((p.second + epsilon) - p0.second) / static_cast<polygon_t>(p.first - p0.first);
+                const auto e = tolerance(p.second, epsilon, delta);
+                const auto dy = static_cast<polygon_t>(p.second - p0.second);
+                auto _lq = (dy - e) / static_cast<polygon_t>(p.first - p0.first);
+                auto _uq = (dy + e) / static_cast<polygon_t>(p.first - p0.first);
 
                 lowerbound_t l{typename convex_polygon_t::segment_t(m, _lq)};
                 upperbound_t u{typename convex_polygon_t::segment_t(m, _uq)};
@@ -781,16 +807,16 @@ namespace pfa {
         using vec_pna_t = typename std::vector<pna_t>;
         using pna_fun_t = std::variant<typename pla_t::fun_t, typename pea_t::fun_t, typename pqa_t::fun_t, typename psa_t::fun_t>;
 
-        static pna_t make_model(approx_fun_t mt, int64_t epsilon) {
+        static pna_t make_model(approx_fun_t mt, int64_t epsilon, double delta = 0) {
             switch (mt) {
                 case approx_fun_t::Linear:
-                    return pla_t{epsilon};
+                    return pla_t{epsilon, delta};
                 case approx_fun_t::Quadratic:
-                    return pqa_t{epsilon};
+                    return pqa_t{epsilon, delta};
                 case approx_fun_t::Sqrt:
-                    return psa_t{epsilon};
+                    return psa_t{epsilon, delta};
                 case approx_fun_t::Exponential:
-                    return pea_t{epsilon};
+                    return pea_t{epsilon, delta};
                 default:
                     throw std::runtime_error("Not implemented");
             }
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && !defined(MADV_COLLAPSE)
+#define MADV_COLLAPSE 25
+#endif
+
+namespace pfa::neats::huge_pages {
+
+    /** Huge-page backing for the large arrays touched by random access (residuals, Elias-Fano bitvectors) and for the
+     * decompression buffers.
+     *
+     * Buffers of at least `min_bytes` are mmap'd: first with MAP_HUGETLB (explicitly reserved pages), otherwise as
+     * 2MB-aligned anonymous memory advised with MADV_HUGEPAGE, so that transparent huge pages back them when the kernel
+     * allows it. Memory owned by sdsl is advised (and collapsed) in place with advise(). The behaviour is on by default
+     * when the library is built with ENABLE_HUGE_PAGES (USE_HUGE_PAGES), and can be toggled at runtime with
+     * set_enabled(); on non-Linux systems everything falls back to the regular allocator. */
+
+    inline constexpr size_t page_size = size_t{1} << 21;
+    inline constexpr size_t min_bytes = page_size / 2;
+
+    inline std::atomic<bool> &enabled_flag() {
+#ifdef USE_HUGE_PAGES
+        static std::atomic<bool> flag{true};
+#else
+        static std::atomic<bool> flag{false};
+#endif
+        return flag;
+    }
+
+    [[nodiscard]] inline bool enabled() {
+        return enabled_flag().load(std::memory_order_relaxed);
+    }
+
+    inline void set_enabled(bool on) {
+        enabled_flag().store(on, std::memory_order_relaxed);
+    }
+
+    /** Asks the kernel to back the 2MB-aligned pages inside [p, p + bytes) with huge pages, collapsing the ones that are
+     * already populated. Returns false if nothing was advised. */
+    inline bool advise(const void *p, size_t bytes) {
+#if defined(__linux__)
+        if (!enabled() || p == nullptr)
+            return false;
+        auto begin = (reinterpret_cast<uintptr_t>(p) + page_size - 1) & ~(page_size - 1);
+        auto end = (reinterpret_cast<uintptr_t>(p) + bytes) & ~(page_size - 1);
+        if (begin >= end)
+            return false;
+        auto *addr = reinterpret_cast<void *>(begin);
+        if (madvise(addr, end - begin, MADV_HUGEPAGE) != 0)
+            return false;
+        madvise(addr, end - begin, MADV_COLLAPSE); // best effort, older kernels return EINVAL
+        return true;
+#else
+        (void) p;
+        (void) bytes;
+        return false;
+#endif
+    }
+
+    /** Allocates bytes (rounded up to page_size) of zeroed memory, see huge_pages::allocator. */
+    inline void *allocate(size_t bytes) {
+#if defined(__linux__)
+        const auto size = (bytes + page_size - 1) & ~(page_size - 1);
+        if (enabled()) {
+            auto *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED)
+                return p;
+        }
+
+        // over-allocate and trim, so that the mapping starts on a huge page boundary
+        auto *raw = mmap(nullptr, size + page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+            throw std::bad_alloc();
+        auto begin = reinterpret_cast<uintptr_t>(raw);
+        auto aligned = (begin + page_size - 1) & ~(page_size - 1);
+        if (aligned > begin)
+            munmap(raw, aligned - begin);
+        if (begin + page_size > aligned)
+            munmap(reinterpret_cast<void *>(aligned + size), begin + page_size - aligned);
+        auto *p = reinterpret_cast<void *>(aligned);
+        if (enabled())
+            madvise(p, size, MADV_HUGEPAGE);
+        return p;
+#else
+        return ::operator new(bytes);
+#endif
+    }
+
+    inline void deallocate(void *p, size_t bytes) {
+#if defined(__linux__)
+        munmap(p, (bytes + page_size - 1) & ~(page_size - 1));
+#else
+        ::operator delete(p);
+#endif
+    }
+
+    /** A std::allocator replacement that places large buffers on huge pages. Whether a buffer is mmap'd depends only on
+     * its size, so memory allocated before a call to set_enabled() is still released correctly. */
+    template<typename T>
+    struct allocator {
+        using value_type = T;
+
+        allocator() noexcept = default;
+
+        template<typename U>
+        allocator(const allocator<U> &) noexcept {}
+
+        T *allocate(size_t n) {
+            const auto bytes = n * sizeof(T);
+            if (bytes < min_bytes)
+                return std::allocator<T>{}.allocate(n);
+            return static_cast<T *>(huge_pages::allocate(bytes));
+        }
+
+        void deallocate(T *p, size_t n) noexcept {
+            const auto bytes = n * sizeof(T);
+            if (bytes < min_bytes)
+                std::allocator<T>{}.deallocate(p, n);
+            else
+                huge_pages::deallocate(p, bytes);
+        }
+
+        template<typename U>
+        bool operator==(const allocator<U> &) const noexcept { return true; }
+    };
+
+    template<typename T>
+    using vector = std::vector<T, allocator<T>>;
+
+    /** A read-only, private mapping of a whole file. */
+    class mapped_file {
+        char *ptr = nullptr;
+        size_t bytes = 0;
+
+    public:
+
+        explicit mapped_file(const std::string &fn) {
+#if defined(__linux__)
+            auto fd = ::open(fn.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("cannot open " + fn);
+            struct stat st{};
+            if (fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw std::runtime_error("cannot stat " + fn);
+            }
+            bytes = static_cast<size_t>(st.st_size);
+            if (bytes > 0) {
+                auto *p = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+                if (p == MAP_FAILED) {
+                    ::close(fd);
+                    throw std::runtime_error("cannot map " + fn);
+                }
+                ptr = static_cast<char *>(p);
+                madvise(ptr, bytes, MADV_SEQUENTIAL);
+                if (enabled())
+                    madvise(ptr, bytes, MADV_HUGEPAGE); // only honoured by file systems with large folios
+            }
+            ::close(fd);
+#else
+            throw std::runtime_error("mapped_file is only supported on Linux");
+#endif
+        }
+
+        mapped_file(const mapped_file &) = delete;
+
+        mapped_file &operator=(const mapped_file &) = delete;
+
+        ~mapped_file() {
+#if defined(__linux__)
+            if (ptr != nullptr)
+                munmap(ptr, bytes);
+#endif
+        }
+
+        [[nodiscard]] std::span<const char> data() const {
+            return {ptr, bytes};
+        }
+
+        [[nodiscard]] size_t size() const {
+            return bytes;
+        }
+    };
+}
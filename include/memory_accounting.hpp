@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <sdsl/io.hpp>
+#include <sdsl/util.hpp>
+
+namespace pfa::neats::memory {
+
+    /** Heap accounting of compression and loading, compiled in only when the library is built with
+     * ENABLE_MEMORY_ACCOUNTING (USE_MEMORY_ACCOUNTING). Otherwise allocator<T> is std::allocator<T>, unique_ptr<T> is
+     * std::unique_ptr<T>, every record below is empty and the profile stays zero.
+     *
+     * The temporaries of partitioning (previous, the distances, the polygon vectors) go through the counting allocator
+     * and are exact. The sdsl structures and the members of the compressor are accounted as one allocation of their
+     * size when they are built or loaded, so their resizes in place are not seen. */
+#ifdef USE_MEMORY_ACCOUNTING
+    inline constexpr bool enabled = true;
+#else
+    inline constexpr bool enabled = false;
+#endif
+
+    enum class phase : uint8_t {
+        partitioning,   // the whole partitioning, including make_residuals
+        make_residuals, // simd_make_residuals, including the index construction
+        load,
+        COUNT
+    };
+
+    inline constexpr std::array<const char *, std::to_underlying(phase::COUNT)> phase_names{
+            "partitioning", "make_residuals", "load"};
+
+    /** peak_bytes is the largest amount of memory the phase held at once on top of what was live when it began,
+     * retained_bytes what it still holds at its end (the compressor, for partitioning and load). */
+    struct phase_stats {
+        uint64_t calls = 0;
+        uint64_t allocations = 0;
+        uint64_t deallocations = 0;
+        uint64_t allocated_bytes = 0;
+        uint64_t peak_bytes = 0;
+        int64_t retained_bytes = 0;
+    };
+
+    struct allocation_profile {
+        std::array<phase_stats, std::to_underlying(phase::COUNT)> phases{};
+
+        [[nodiscard]] const phase_stats &operator[](phase p) const {
+            return phases[std::to_underlying(p)];
+        }
+
+        /** Writes one `phase,calls,allocations,deallocations,allocated_bytes,peak_bytes,retained_bytes` line per
+         * phase. */
+        void print(std::ostream &os) const {
+            os << "phase,calls,allocations,deallocations,allocated_bytes,peak_bytes,retained_bytes" << std::endl;
+            for (size_t p = 0; p < phases.size(); ++p)
+                os << phase_names[p] << "," << phases[p].calls << "," << phases[p].allocations << ","
+                   << phases[p].deallocations << "," << phases[p].allocated_bytes << "," << phases[p].peak_bytes
+                   << "," << phases[p].retained_bytes << std::endl;
+        }
+    };
+
+    namespace detail {
+        /* The live bytes may go below zero, when a thread frees what another one allocated: only differences are
+         * reported. */
+        struct tracker {
+            int64_t live = 0;
+            int64_t peak = 0;
+            uint64_t allocations = 0;
+            uint64_t deallocations = 0;
+            uint64_t allocated_bytes = 0;
+        };
+
+        inline tracker &current_tracker() {
+            thread_local tracker t;
+            return t;
+        }
+
+        inline allocation_profile &profile() {
+            thread_local allocation_profile p;
+            return p;
+        }
+    }
+
+    /** The profile accumulated by the calling thread since the last reset. */
+    [[nodiscard]] inline const allocation_profile &current() {
+        return detail::profile();
+    }
+
+    inline void reset() {
+        if constexpr (enabled)
+            detail::profile() = {};
+    }
+
+    inline void allocated(size_t bytes) {
+        if constexpr (enabled) {
+            auto &t = detail::current_tracker();
+            ++t.allocations;
+            t.allocated_bytes += bytes;
+            t.live += static_cast<int64_t>(bytes);
+            t.peak = std::max(t.peak, t.live);
+        }
+    }
+
+    inline void deallocated(size_t bytes) {
+        if constexpr (enabled) {
+            auto &t = detail::current_tracker();
+            ++t.deallocations;
+            t.live -= static_cast<int64_t>(bytes);
+        }
+    }
+
+    /** A std::allocator that records its allocations in the tracker of the calling thread. */
+    template<typename T>
+    struct counting_allocator {
+        using value_type = T;
+
+        counting_allocator() = default;
+
+        template<typename U>
+        constexpr counting_allocator(const counting_allocator<U> &) noexcept {}
+
+        T *allocate(size_t n) {
+            auto p = std::allocator<T>{}.allocate(n);
+            allocated(n * sizeof(T));
+            return p;
+        }
+
+        void deallocate(T *p, size_t n) noexcept {
+            deallocated(n * sizeof(T));
+            std::allocator<T>{}.deallocate(p, n);
+        }
+
+        template<typename U>
+        bool operator==(const counting_allocator<U> &) const noexcept {
+            return true;
+        }
+    };
+
+    template<typename T>
+    struct counting_delete {
+        void operator()(T *p) const {
+            deallocated(sizeof(T));
+            delete p;
+        }
+    };
+
+    template<typename T>
+    using allocator = std::conditional_t<enabled, counting_allocator<T>, std::allocator<T>>;
+
+    template<typename T>
+    using vector = std::vector<T, allocator<T>>;
+
+    template<typename T>
+    using unique_ptr = std::unique_ptr<T, std::conditional_t<enabled, counting_delete<T>, std::default_delete<T>>>;
+
+    template<typename T, typename... Args>
+    unique_ptr<T> make_unique(Args &&... args) {
+        unique_ptr<T> p{new T(std::forward<Args>(args)...)};
+        allocated(sizeof(T));
+        return p;
+    }
+
+    /** The heap bytes of a structure: its capacity for a std::vector, size_in_bytes() or size_in_bits() for the
+     * structures that have them, sdsl::size_in_bytes otherwise. */
+    template<typename S>
+    [[nodiscard]] size_t bytes_of(const S &s) {
+        if constexpr (requires { typename S::allocator_type; s.capacity(); })
+            return s.capacity() * sizeof(typename S::value_type);
+        else if constexpr (requires { s.size_in_bytes(); })
+            return s.size_in_bytes();
+        else if constexpr (requires { s.size_in_bits(); })
+            return (s.size_in_bits() + 7) / 8;
+        else
+            return sdsl::size_in_bytes(s);
+    }
+
+    /** Records each structure, just built or loaded, as one allocation of its size. */
+    template<typename... S>
+    void account(const S &... s) {
+        if constexpr (enabled)
+            (allocated(bytes_of(s)), ...);
+    }
+
+    /** sdsl::util::bit_compress, recording the memory it gives back. */
+    template<typename V>
+    void bit_compress(V &v) {
+        if constexpr (enabled) {
+            const auto before = bytes_of(v);
+            sdsl::util::bit_compress(v);
+            const auto after = bytes_of(v);
+            if (after < before)
+                deallocated(before - after);
+        } else {
+            sdsl::util::bit_compress(v);
+        }
+    }
+
+    /** Adds the allocations from its construction to its destruction to a phase of the profile of the calling thread.
+     * Scopes nest: the peak of an inner scope counts towards the peak of the enclosing one. */
+    class scope {
+#ifdef USE_MEMORY_ACCOUNTING
+        phase p;
+        detail::tracker start;
+
+    public:
+
+        explicit scope(phase _p) : p{_p}, start{detail::current_tracker()} {
+            detail::current_tracker().peak = start.live;
+        }
+
+        ~scope() {
+            auto &t = detail::current_tracker();
+            auto &s = detail::profile().phases[std::to_underlying(p)];
+            ++s.calls;
+            s.allocations += t.allocations - start.allocations;
+            s.deallocations += t.deallocations - start.deallocations;
+            s.allocated_bytes += t.allocated_bytes - start.allocated_bytes;
+            s.peak_bytes = std::max(s.peak_bytes, static_cast<uint64_t>(t.peak - start.live));
+            s.retained_bytes += t.live - start.live;
+            t.peak = std::max(t.peak, start.peak);
+        }
+#else
+    public:
+
+        explicit scope(phase) {}
+#endif
+
+        scope(const scope &) = delete;
+
+        scope &operator=(const scope &) = delete;
+    };
+}
@@ -10,6 +10,7 @@
 #include <sux/bits/SimpleSelectHalf.hpp>
 #include <sux/bits/SimpleSelectZero.hpp>
 #include <sux/bits/SimpleSelectZeroHalf.hpp>
+#include "huge_pages.hpp"
 
 // Returns the width of the integers stored in the low part of an Elias-Fano-coded sequence.
 //
@@ -74,7 +75,8 @@ public:
 
     MyEliasFano() = default;
 
-    explicit MyEliasFano(const std::vector<uint64_t> &data) {
+    template<typename Alloc>
+    explicit MyEliasFano(const std::vector<uint64_t, Alloc> &data) {
         if (data.empty())
             return;
 
@@ -188,6 +190,12 @@ public:
         return sdsl::size_in_bytes(v) + sdsl::size_in_bytes(H) + select0.bitCount() / 8 + select1.bitCount() / 8;
     }
 
+    /** Asks for huge pages on the low and high bits, see pfa::neats::huge_pages::advise. */
+    void advise_huge_pages() const {
+        pfa::neats::huge_pages::advise(v.data(), sdsl::size_in_bytes(v));
+        pfa::neats::huge_pages::advise(H.data(), sdsl::size_in_bytes(H));
+    }
+
     size_t inline serialize(std::ostream &os, sdsl::structure_tree_node *_v = nullptr, std::string name = "") const {
         size_t written_bytes = 0;
         written_bytes += sdsl::write_member(AllowRank, os, _v, name + "_AllowRank");
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <utility>
+
+namespace pfa::neats::profiling {
+
+    /** Breakdown of the time spent by partitioning, compiled in only when the library is built with ENABLE_PROFILING
+     * (USE_PROFILING). Otherwise every scope and count below is empty and the profile stays zero. */
+#ifdef USE_PROFILING
+    inline constexpr bool enabled = true;
+#else
+    inline constexpr bool enabled = false;
+#endif
+
+    /** The timed phases. The four make_segment phases follow the order of approx_fun_t. */
+    enum class phase : uint8_t {
+        make_segment_linear,
+        make_segment_exponential,
+        make_segment_quadratic,
+        make_segment_sqrt,
+        polygon_update,       // convex_polygon::update, including its cuts
+        relaxations,          // the distance relaxations of the shortest path
+        previous_allocations, // the copies of the fragments stored in previous
+        backward_walk,        // the walk from n to 0 that selects the fragments
+        make_residuals,       // residuals, coefficients and exceptions (simd_make_residuals)
+        index_construction,   // Elias-Fano, rank supports and bit compression
+        aggregates,           // build_aggregates
+        partitioning,         // the whole partitioning
+        COUNT
+    };
+
+    /** The counted events. */
+    enum class counter : uint8_t {
+        polygon_cuts,         // convex_polygon::cut
+        edges_relaxed,        // edges of the graph of the fragments considered by the relaxations
+        distance_improvements,
+        COUNT
+    };
+
+    inline constexpr std::array<const char *, std::to_underlying(phase::COUNT)> phase_names{
+            "make_segment_linear", "make_segment_exponential", "make_segment_quadratic", "make_segment_sqrt",
+            "polygon_update", "relaxations", "previous_allocations", "backward_walk", "make_residuals",
+            "index_construction", "aggregates", "partitioning"};
+
+    inline constexpr std::array<const char *, std::to_underlying(counter::COUNT)> counter_names{
+            "polygon_cuts", "edges_relaxed", "distance_improvements"};
+
+    /** ns includes the time of the phases nested in this one, self_ns does not. */
+    struct phase_stats {
+        uint64_t calls = 0;
+        uint64_t ns = 0;
+        uint64_t self_ns = 0;
+    };
+
+    struct compression_profile {
+        std::array<phase_stats, std::to_underlying(phase::COUNT)> phases{};
+        std::array<uint64_t, std::to_underlying(counter::COUNT)> counters{};
+
+        [[nodiscard]] const phase_stats &operator[](phase p) const {
+            return phases[std::to_underlying(p)];
+        }
+
+        [[nodiscard]] uint64_t operator[](counter c) const {
+            return counters[std::to_underlying(c)];
+        }
+
+        /** Writes one `name,calls,ns,self_ns` line per phase and one `name,count,,` line per counter. */
+        void print(std::ostream &os) const {
+            os << "phase,calls,ns,self_ns" << std::endl;
+            for (size_t p = 0; p < phases.size(); ++p)
+                os << phase_names[p] << "," << phases[p].calls << "," << phases[p].ns << "," << phases[p].self_ns
+                   << std::endl;
+            for (size_t c = 0; c < counters.size(); ++c)
+                os << counter_names[c] << "," << counters[c] << ",," << std::endl;
+        }
+    };
+
+    class scope;
+
+    namespace detail {
+        inline compression_profile &profile() {
+            thread_local compression_profile p;
+            return p;
+        }
+
+        inline scope *&innermost() {
+            thread_local scope *s = nullptr;
+            return s;
+        }
+    }
+
+    /** The profile accumulated by the calling thread since the last reset. */
+    [[nodiscard]] inline const compression_profile &current() {
+        return detail::profile();
+    }
+
+    inline void reset() {
+        if constexpr (enabled)
+            detail::profile() = {};
+    }
+
+    inline void count(counter c, uint64_t v = 1) {
+        if constexpr (enabled)
+            detail::profile().counters[std::to_underlying(c)] += v;
+    }
+
+    /** Adds the time from its construction to its destruction to a phase of the profile of the calling thread, and
+     * removes it from the self time of the enclosing scope. The clock is read twice per scope (tens of ns), so the
+     * fine-grained phases (polygon_update) are inflated: compare their shares, not their absolute times. */
+    class scope {
+#ifdef USE_PROFILING
+        phase p;
+        scope *parent;
+        uint64_t children_ns = 0;
+        std::chrono::steady_clock::time_point t0;
+
+    public:
+
+        explicit scope(phase _p) : p{_p}, parent{detail::innermost()}, t0{std::chrono::steady_clock::now()} {
+            detail::innermost() = this;
+        }
+
+        ~scope() {
+            const auto ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - t0).count());
+            auto &s = detail::profile().phases[std::to_underlying(p)];
+            ++s.calls;
+            s.ns += ns;
+            s.self_ns += ns - std::min(ns, children_ns);
+            if (parent != nullptr)
+                parent->children_ns += ns;
+            detail::innermost() = parent;
+        }
+#else
+    public:
+
+        explicit scope(phase) {}
+#endif
+
+        scope(const scope &) = delete;
+
+        scope &operator=(const scope &) = delete;
+    };
+}
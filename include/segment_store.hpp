@@ -0,0 +1,314 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+#include "NeaTS.hpp"
+
+namespace pfa::neats {
+
+    /** An append-only series made of independently compressed blocks.
+     *
+     * Every append() compresses the new values (and their timestamps, with a second compressor) into a new block and
+     * adds it to the manifest, which maps global positions and timestamp ranges to blocks. Reads take a shared lock and
+     * may span several blocks. Small blocks are merged by compact(), which re-runs partitioning on their concatenation
+     * without holding the lock, and can be run periodically by a background thread. */
+    template<typename compressor_t = pfa::neats::compressor<uint32_t, int64_t, double, float, double>>
+    class segment_store {
+
+        // compressors are kept behind a pointer: moving them would leave the rank supports pointing to the old
+        // bit_vectors
+        struct block {
+            uint64_t first; // global position of the first value
+            uint64_t size;
+            int64_t first_ts;
+            int64_t last_ts;
+            int64_t values_shift;
+            int64_t timestamps_shift;
+            std::unique_ptr<compressor_t> values;
+            std::unique_ptr<compressor_t> timestamps;
+
+            [[nodiscard]] uint64_t end() const {
+                return first + size;
+            }
+
+            [[nodiscard]] int64_t value_at(uint64_t i) const {
+                return (*values)[i - first] + values_shift;
+            }
+
+            [[nodiscard]] int64_t timestamp_at(uint64_t i) const {
+                return (*timestamps)[i - first] + timestamps_shift;
+            }
+
+            /** Decompresses the values of [s, e) (global positions) into out. */
+            void scan(uint64_t s, uint64_t e, int64_t *out) const {
+                // fragments with bpc == 0 add their approximation to out without unpacking residuals first
+                std::fill(out, out + (e - s), 0);
+                values->simd_scan(s - first, e - first, out);
+                for (uint64_t j = 0; j < e - s; ++j)
+                    out[j] += values_shift;
+            }
+
+            void scan_timestamps(uint64_t s, uint64_t e, int64_t *out) const {
+                std::fill(out, out + (e - s), 0);
+                timestamps->simd_scan(s - first, e - first, out);
+                for (uint64_t j = 0; j < e - s; ++j)
+                    out[j] += timestamps_shift;
+            }
+        };
+
+        using block_ptr = std::shared_ptr<const block>;
+
+        uint8_t bpc;
+        uint8_t timestamps_bpc;
+        uint64_t compaction_threshold;
+
+        std::vector<block_ptr> blocks; // the manifest, sorted by first
+        uint64_t n = 0;
+        mutable std::shared_mutex blocks_m;
+        std::mutex append_m;
+        std::mutex compaction_m;
+
+        std::jthread compactor;
+        std::mutex compactor_m;
+        std::condition_variable_any compactor_cv;
+
+    public:
+
+        /** Blocks with less than compaction_threshold values are merged by compact(). */
+        explicit segment_store(uint8_t bpc = 16, uint8_t timestamps_bpc = 4, uint64_t compaction_threshold = 1 << 16)
+                : bpc{bpc}, timestamps_bpc{timestamps_bpc}, compaction_threshold{compaction_threshold} {}
+
+        segment_store(const segment_store &) = delete;
+
+        segment_store &operator=(const segment_store &) = delete;
+
+        ~segment_store() {
+            stop_compaction();
+        }
+
+        /** Appends values[i] with timestamp timestamps[i]. Timestamps must be non-decreasing, also across appends. */
+        void append(const std::vector<int64_t> &timestamps, const std::vector<int64_t> &values) {
+            if (timestamps.size() != values.size())
+                throw std::runtime_error("timestamps and values must have the same size");
+            if (values.empty())
+                return;
+            if (!std::is_sorted(timestamps.begin(), timestamps.end()))
+                throw std::runtime_error("timestamps must be non-decreasing");
+
+            std::lock_guard lock(append_m);
+            uint64_t first;
+            {
+                std::shared_lock read_lock(blocks_m);
+                if (!blocks.empty() && timestamps.front() < blocks.back()->last_ts)
+                    throw std::runtime_error("timestamps must be non-decreasing");
+                first = n;
+            }
+
+            auto b = make_block(first, timestamps, values);
+            std::unique_lock write_lock(blocks_m);
+            blocks.push_back(std::move(b));
+            n += values.size();
+        }
+
+        [[nodiscard]] uint64_t size() const {
+            std::shared_lock lock(blocks_m);
+            return n;
+        }
+
+        [[nodiscard]] size_t num_blocks() const {
+            std::shared_lock lock(blocks_m);
+            return blocks.size();
+        }
+
+        int64_t operator[](uint64_t i) const {
+            std::shared_lock lock(blocks_m);
+            if (i >= n)
+                throw std::out_of_range("position out of range");
+            return (*find_block(i))->value_at(i);
+        }
+
+        int64_t timestamp(uint64_t i) const {
+            std::shared_lock lock(blocks_m);
+            if (i >= n)
+                throw std::out_of_range("position out of range");
+            return (*find_block(i))->timestamp_at(i);
+        }
+
+        /** Writes the values in the positions [from, to) to out, which must have room for to - from values. */
+        void scan(uint64_t from, uint64_t to, int64_t *out) const {
+            std::shared_lock lock(blocks_m);
+            if (from > to || to > n)
+                throw std::out_of_range("range out of bounds");
+            if (from == to)
+                return; // find_block needs a non-empty manifest
+            for (auto it = find_block(from); from < to; ++it) {
+                auto e = std::min(to, (*it)->end());
+                (*it)->scan(from, e, out);
+                out += e - from;
+                from = e;
+            }
+        }
+
+        void scan_timestamps(uint64_t from, uint64_t to, int64_t *out) const {
+            std::shared_lock lock(blocks_m);
+            if (from > to || to > n)
+                throw std::out_of_range("range out of bounds");
+            if (from == to)
+                return; // find_block needs a non-empty manifest
+            for (auto it = find_block(from); from < to; ++it) {
+                auto e = std::min(to, (*it)->end());
+                (*it)->scan_timestamps(from, e, out);
+                out += e - from;
+                from = e;
+            }
+        }
+
+        /** Returns the positions [from, to) of the values with timestamp in [t_from, t_to]. */
+        [[nodiscard]] std::pair<uint64_t, uint64_t> time_range(int64_t t_from, int64_t t_to) const {
+            std::shared_lock lock(blocks_m);
+            if (t_from > t_to)
+                return {0, 0};
+            auto from = lower_position(t_from, false);
+            auto to = lower_position(t_to, true);
+            return {from, std::max(from, to)};
+        }
+
+        /** Merges runs of consecutive blocks smaller than the compaction threshold. Returns the number of blocks
+         * removed. Concurrent reads and appends are blocked only while the manifest is updated. */
+        size_t compact() {
+            std::lock_guard lock(compaction_m);
+            std::vector<block_ptr> snapshot;
+            {
+                std::shared_lock read_lock(blocks_m);
+                snapshot = blocks;
+            }
+
+            // runs [a, b) of small blocks, each run is merged into a single block
+            std::vector<std::tuple<size_t, size_t, block_ptr>> merged;
+            for (size_t a = 0; a < snapshot.size();) {
+                size_t b = a;
+                uint64_t run_size = 0;
+                while (b < snapshot.size() && snapshot[b]->size < compaction_threshold && run_size < compaction_threshold)
+                    run_size += snapshot[b++]->size;
+                if (b - a >= 2)
+                    merged.emplace_back(a, b, merge(snapshot.begin() + a, snapshot.begin() + b));
+                a = std::max(a + 1, b);
+            }
+            if (merged.empty())
+                return 0;
+
+            // appends only add blocks at the end, so the indices of the snapshot are still valid
+            size_t removed = 0;
+            std::unique_lock write_lock(blocks_m);
+            for (auto it = merged.rbegin(); it != merged.rend(); ++it) {
+                auto &[a, b, bp] = *it;
+                blocks.erase(blocks.begin() + a + 1, blocks.begin() + b);
+                blocks[a] = std::move(bp);
+                removed += b - a - 1;
+            }
+            return removed;
+        }
+
+        /** Runs compact() every period on a background thread, until stop_compaction() is called. */
+        void start_compaction(std::chrono::milliseconds period) {
+            stop_compaction();
+            compactor = std::jthread([this, period](std::stop_token st) {
+                while (!st.stop_requested()) {
+                    compact();
+                    std::unique_lock lock(compactor_m);
+                    compactor_cv.wait_for(lock, st, period, [] { return false; });
+                }
+            });
+        }
+
+        void stop_compaction() {
+            if (compactor.joinable()) {
+                compactor.request_stop();
+                compactor.join();
+            }
+        }
+
+        [[nodiscard]] size_t size_in_bits() const {
+            std::shared_lock lock(blocks_m);
+            size_t bits = sizeof(*this) * 8;
+            for (const auto &b: blocks)
+                bits += sizeof(block) * 8 + b->values->size_in_bits() + b->timestamps->size_in_bits();
+            return bits;
+        }
+
+    private:
+
+        /** Returns the block that contains the position i, blocks_m must be held. */
+        typename std::vector<block_ptr>::const_iterator find_block(uint64_t i) const {
+            return std::upper_bound(blocks.begin(), blocks.end(), i,
+                                    [](uint64_t x, const block_ptr &b) { return x < b->first; }) - 1;
+        }
+
+        /** Returns the first position whose timestamp is >= t (> t if strict), blocks_m must be held. */
+        [[nodiscard]] uint64_t lower_position(int64_t t, bool strict) const {
+            auto it = std::partition_point(blocks.begin(), blocks.end(), [&](const block_ptr &b) {
+                return strict ? b->last_ts <= t : b->last_ts < t;
+            });
+            if (it == blocks.end())
+                return n;
+
+            const auto &b = *it;
+            uint64_t lo = b->first, hi = b->end();
+            while (lo < hi) {
+                auto mid = lo + (hi - lo) / 2;
+                auto ts = b->timestamp_at(mid);
+                if (strict ? ts <= t : ts < t) lo = mid + 1;
+                else hi = mid;
+            }
+            return lo;
+        }
+
+        template<typename It>
+        block_ptr merge(It begin, It end) const {
+            std::vector<int64_t> timestamps, values;
+            for (auto it = begin; it != end; ++it) {
+                const auto &b = *it;
+                auto offset = values.size();
+                timestamps.resize(offset + b->size);
+                values.resize(offset + b->size);
+                b->scan_timestamps(b->first, b->end(), timestamps.data() + offset);
+                b->scan(b->first, b->end(), values.data() + offset);
+            }
+            return make_block((*begin)->first, timestamps, values);
+        }
+
+        /** Compresses data after shifting its minimum to epsilon + 1 (unlike _preprocess_data, positive data is shifted
+         * too, so that e.g. epoch timestamps stay well within the precision of the coefficients). Returns the shift. */
+        static int64_t compress(std::vector<int64_t> data, uint8_t _bpc, std::unique_ptr<compressor_t> &c) {
+            auto min_data = *std::min_element(data.begin(), data.end());
+            auto shift = min_data - 1 - static_cast<int64_t>(BPC_TO_EPSILON(_bpc));
+            for (auto &d: data)
+                d -= shift;
+            c = std::make_unique<compressor_t>(_bpc);
+            c->partitioning(data.begin(), data.end());
+            return shift;
+        }
+
+        block_ptr make_block(uint64_t first, const std::vector<int64_t> &timestamps,
+                             const std::vector<int64_t> &values) const {
+            auto b = std::make_shared<block>();
+            b->first = first;
+            b->size = values.size();
+            b->first_ts = timestamps.front();
+            b->last_ts = timestamps.back();
+            b->values_shift = compress(values, bpc, b->values);
+            b->timestamps_shift = compress(timestamps, timestamps_bpc, b->timestamps);
+            return b;
+        }
+    };
+}
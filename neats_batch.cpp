@@ -0,0 +1,55 @@
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include "batch_pipeline.hpp"
+
+/* Given a directory f returns a vector of all the .bin files in the directory */
+std::vector<std::filesystem::path> get_files(const std::filesystem::path &path) {
+    // each file is stat-ed once, while listing the directory
+    std::vector<std::pair<std::uintmax_t, std::filesystem::path>> sized;
+    for (const auto &entry: std::filesystem::directory_iterator(path)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".bin")
+            sized.emplace_back(entry.file_size(), entry.path());
+    }
+    // largest first, so that the long tail of the pipeline is made of small series
+    std::sort(sized.begin(), sized.end(), [](const auto &a, const auto &b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+    std::vector<std::filesystem::path> files;
+    files.reserve(sized.size());
+    for (auto &[size, fn]: sized)
+        files.push_back(std::move(fn));
+    return files;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <in_dir> <out_dir> <bpc> [first_is_size=1] [readers=2] [workers=#cores] [writers=2] [queue=8] [verify=1]"
+                  << std::endl;
+        return 1;
+    }
+
+    pfa::neats::batch::options opts;
+    opts.out_dir = argv[2];
+    opts.bpc = std::stoi(argv[3]);
+    if (argc > 4) opts.first_is_size = std::stoi(argv[4]) != 0;
+    if (argc > 5) opts.num_readers = std::max(1, std::stoi(argv[5]));
+    if (argc > 6) opts.num_workers = std::max(1, std::stoi(argv[6]));
+    if (argc > 7) opts.num_writers = std::max(1, std::stoi(argv[7]));
+    if (argc > 8) opts.queue_capacity = std::max(1, std::stoi(argv[8]));
+    if (argc > 9) opts.verify = std::stoi(argv[9]) != 0;
+
+    std::filesystem::create_directories(opts.out_dir);
+    auto fns = get_files(argv[1]);
+
+    pfa::neats::batch::pipeline<> p{opts};
+    p.run(fns);
+    p.print_counters(std::cout);
+    std::cout << "files," << fns.size() << ",wall_time(s)," << p.wall_ns / 1e9 << std::endl;
+
+    auto failures = p.read_counters.failures + p.compress_counters.failures + p.write_counters.failures;
+    return failures == 0 ? 0 : 2;
+}